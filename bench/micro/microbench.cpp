@@ -0,0 +1,345 @@
+// Microbenchmarks for the hot kernels of the tracer.
+//
+// This embeds R, builds synthetic values of controlled shapes and sizes by
+// evaluating small R expressions, and times each kernel in isolation. Every
+// benchmark is warmed up and then sampled repeatedly; one CSV row with summary
+// statistics (nanoseconds per iteration) is printed per benchmark:
+//
+//   kernel,shape,size,samples,iterations,mean_ns,sd_ns,min_ns,median_ns,p95_ns
+//
+// Before timing anything, this checks that the types cached by TracerState
+// follow values modified in place.
+//
+// Usage: R_HOME=<R-dyntrace> microbench [samples] [kernel-filter]
+//
+// See the microbench target of the Makefile. R-dyntrace has to be configured
+// with --enable-R-shlib for this to link.
+
+#include "TracerState.h"
+
+#include <R_ext/Parse.h>
+#include <Rembedded.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+
+namespace {
+
+int sample_count = 30;
+std::string kernel_filter = "";
+std::string output_dirpath = "/tmp/propagatr-microbench";
+
+/* results of the kernels are accumulated here so they are not optimized
+   away */
+volatile std::size_t sink = 0;
+
+SEXP make_value(const std::string& code) {
+    ParseStatus status;
+    SEXP text = PROTECT(Rf_mkString(code.c_str()));
+    SEXP expressions = PROTECT(R_ParseVector(text, -1, &status, R_NilValue));
+    if (status != PARSE_OK) {
+        failwith("unable to parse '%s'\n", code.c_str());
+    }
+    SEXP value = R_NilValue;
+    for (int i = 0; i < LENGTH(expressions); ++i) {
+        value = Rf_eval(VECTOR_ELT(expressions, i), R_GlobalEnv);
+    }
+    R_PreserveObject(value);
+    UNPROTECT(2);
+    return value;
+}
+
+/* returns the per iteration time of each sample in nanoseconds */
+template <typename F>
+std::vector<double> sample(int iterations, F body) {
+    /* warm up caches and the allocator */
+    for (int i = 0; i < std::max(1, iterations / 10); ++i) {
+        body();
+    }
+
+    std::vector<double> samples;
+    samples.reserve(sample_count);
+    for (int s = 0; s < sample_count; ++s) {
+        std::uint64_t start = read_cycle_counter();
+        for (int i = 0; i < iterations; ++i) {
+            body();
+        }
+        std::uint64_t ticks = read_cycle_counter() - start;
+        samples.push_back(ticks / get_cycle_counter_ticks_per_nanosecond() /
+                          iterations);
+    }
+    return samples;
+}
+
+void report(const std::string& kernel,
+            const std::string& shape,
+            int size,
+            int iterations,
+            std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    double mean = std::accumulate(samples.begin(), samples.end(), 0.0) /
+                  samples.size();
+    double variance = 0;
+    for (double sample: samples) {
+        variance += (sample - mean) * (sample - mean);
+    }
+    double sd = samples.size() > 1 ? std::sqrt(variance / (samples.size() - 1))
+                                   : 0;
+    double median = samples[samples.size() / 2];
+    double p95 = samples[std::min(samples.size() - 1,
+                                  (std::size_t)(samples.size() * 0.95))];
+
+    std::cout << kernel << "," << shape << "," << size << ","
+              << samples.size() << "," << iterations << "," << mean << ","
+              << sd << "," << samples.front() << "," << median << "," << p95
+              << std::endl;
+}
+
+template <typename F>
+void benchmark(const std::string& kernel,
+               const std::string& shape,
+               int size,
+               int iterations,
+               F body) {
+    if (kernel.find(kernel_filter) == std::string::npos) {
+        return;
+    }
+    report(kernel, shape, size, iterations, sample(iterations, body));
+}
+
+/* fewer iterations for bigger values, so every sample takes similar time */
+int iterations_for(int size) {
+    return std::max(10, 100000 / std::max(1, size));
+}
+
+struct shape_t {
+    std::string name;
+    /* R expression, {N} is replaced by the size */
+    std::string code;
+    /* vector type for vector_logic, empty for lists */
+    std::string vector_type;
+};
+
+const std::vector<shape_t> SHAPES{
+    {"logical", "sample(c(TRUE, FALSE), {N}, replace = TRUE)", "logical"},
+    {"logical_na",
+     "sample(c(TRUE, FALSE, NA), {N}, replace = TRUE)",
+     "logical"},
+    {"integer", "seq_len({N})", "integer"},
+    {"double", "as.double(seq_len({N}))", "double"},
+    {"double_named",
+     "setNames(as.double(seq_len({N})), paste0('x', seq_len({N})))",
+     "double"},
+    {"character", "as.character(seq_len({N}))", "character"},
+    {"list", "as.list(seq_len({N}))", ""},
+    {"list_named",
+     "setNames(as.list(seq_len({N})), paste0('x', seq_len({N})))",
+     ""},
+    {"list_nested", "lapply(seq_len({N}), function(i) list(i, letters))", ""},
+    {"data_frame",
+     "data.frame(a = seq_len({N}), b = rep('x', {N}), c = rnorm({N}), "
+     "stringsAsFactors = FALSE)",
+     ""}};
+
+const std::vector<int> SIZES{1, 100, 10000};
+
+/* the placeholder cannot appear in R code, unlike N, which is in NA */
+const std::string SIZE_PLACEHOLDER = "{N}";
+
+std::string instantiate(std::string code, int size) {
+    std::string size_string = std::to_string(size) + "L";
+    std::size_t position;
+    while ((position = code.find(SIZE_PLACEHOLDER)) != std::string::npos) {
+        code.replace(position, SIZE_PLACEHOLDER.size(), size_string);
+    }
+    return code;
+}
+
+void benchmark_typing() {
+    for (const shape_t& shape: SHAPES) {
+        for (int size: SIZES) {
+            SEXP value = make_value(instantiate(shape.code, size));
+            int iterations = iterations_for(size);
+
+            benchmark("get_type_of_sexp",
+                      shape.name,
+                      size,
+                      iterations,
+                      [value]() { sink += get_type_of_sexp(value).size(); });
+
+            if (!shape.vector_type.empty()) {
+                std::string vector_type = shape.vector_type;
+                benchmark("vector_logic",
+                          shape.name,
+                          size,
+                          iterations,
+                          [value, vector_type]() {
+                              sink += vector_logic(vector_type, value).size();
+                          });
+            } else {
+                benchmark("list_logic",
+                          shape.name,
+                          size,
+                          iterations,
+                          [value]() { sink += list_logic(value).size(); });
+            }
+
+            R_ReleaseObject(value);
+        }
+    }
+}
+
+/* a call trace with the given number of arguments, whose types are taken
+   round robin from values. distinct traces are made by varying the name. */
+CallTrace make_call_trace(int index,
+                          int argument_count,
+                          const std::vector<Type>& types) {
+    CallTrace trace("microbench",
+                    "f" + std::to_string(index),
+                    "fn-id-" + std::to_string(index),
+                    DYNTRACE_DISPATCH_NONE,
+                    index);
+    for (int position = -1; position < argument_count; ++position) {
+        trace.add_to_call_trace(
+            position, types[(position + 1 + index) % types.size()]);
+    }
+    return trace;
+}
+
+std::vector<Type> make_types() {
+    std::vector<Type> types;
+    for (const shape_t& shape: SHAPES) {
+        SEXP value = make_value(instantiate(shape.code, 10));
+        types.push_back(Type(value));
+        R_ReleaseObject(value);
+    }
+    return types;
+}
+
+TracerState* make_tracer_state() {
+    return new TracerState(output_dirpath,
+                           "microbench",
+                           "microbench",
+                           false,
+                           true,
+                           false,
+                           0,
+                           {},
+                           TypingMode::Full,
+                           false,
+                           0,
+                           false,
+                           false,
+                           false,
+                           0,
+                           "",
+                           0,
+                           "");
+}
+
+void benchmark_call_traces() {
+    std::vector<Type> types = make_types();
+
+    for (int argument_count: {0, 4, 16}) {
+        CallTrace trace = make_call_trace(0, argument_count, types);
+        benchmark("CallTrace::compute_hash",
+                  "arguments",
+                  argument_count,
+                  100000,
+                  [&trace]() { sink += trace.compute_hash(); });
+    }
+
+    for (int trace_count: {10, 1000, 100000}) {
+        std::vector<CallTrace> traces;
+        traces.reserve(trace_count);
+        for (int index = 0; index < trace_count; ++index) {
+            traces.push_back(make_call_trace(index, 4, types));
+        }
+
+        /* after the first pass every trace is already in the table */
+        TracerState* state = make_tracer_state();
+        std::size_t next = 0;
+        benchmark("TracerState::deal_with_call_trace",
+                  "distinct_traces",
+                  trace_count,
+                  10000,
+                  [state, &traces, &next]() {
+                      state->deal_with_call_trace(traces[next]);
+                      next = (next + 1) % traces.size();
+                  });
+
+        /* fill the table completely before serializing it */
+        for (const CallTrace& trace: traces) {
+            state->deal_with_call_trace(trace);
+        }
+        benchmark("TracerState::serialize_traces_list",
+                  "distinct_traces",
+                  trace_count,
+                  1,
+                  [state]() { state->serialize_traces_list(); });
+
+        delete state;
+    }
+}
+
+/* The type cached for a shared value must not outlive an in-place change of
+   its attributes while it is unshared, fails otherwise. Sharing is set
+   directly to play the references to the value coming and going. */
+void check_value_type() {
+    TracerState* state = make_tracer_state();
+    SEXP value = PROTECT(Rf_allocVector(REALSXP, 2));
+    REAL(value)[0] = 1;
+    REAL(value)[1] = 2;
+
+    SET_NAMED(value, 2);
+    Type before = state->get_value_type(value);
+
+    SET_NAMED(value, 0);
+    state->get_value_type(value);
+    SEXP names = PROTECT(Rf_allocVector(STRSXP, 2));
+    SET_STRING_ELT(names, 0, Rf_mkChar("a"));
+    SET_STRING_ELT(names, 1, Rf_mkChar("b"));
+    Rf_setAttrib(value, R_NamesSymbol, names);
+
+    SET_NAMED(value, 2);
+    Type after = state->get_value_type(value);
+    if (after == before || !(after == Type(value))) {
+        failwith("%s\n", "stale type of a value modified in place");
+    }
+
+    UNPROTECT(2);
+    delete state;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        sample_count = std::max(1, std::atoi(argv[1]));
+    }
+    if (argc > 2) {
+        kernel_filter = argv[2];
+    }
+
+    char* r_argv[] = {(char*) "microbench",
+                      (char*) "--slave",
+                      (char*) "--no-save",
+                      (char*) "--vanilla"};
+    Rf_initEmbeddedR(4, r_argv);
+
+    mkdir_p(output_dirpath.c_str(), S_IRWXU);
+
+    std::cout << "kernel,shape,size,samples,iterations,mean_ns,sd_ns,min_ns,"
+                 "median_ns,p95_ns"
+              << std::endl;
+
+    check_value_type();
+    benchmark_typing();
+    benchmark_call_traces();
+
+    Rf_endEmbeddedR(0);
+
+    return 0;
+}
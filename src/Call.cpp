@@ -12,4 +12,5 @@ Call::Call(const call_id_t id,
     , environment_(environment)
     , function_(function)
     , return_value_type_(UNASSIGNEDSXP)
-    , jumped_(false) { }
+    , jumped_(false)
+    , theTrace(nullptr) { }
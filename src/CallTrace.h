@@ -3,12 +3,15 @@
 
 #include "Type.h"
 #include <iostream>
+#include <unordered_map>
 // NOTE for mac need : export LIBRARY_PATH=/usr/local/opt/openssl/lib/
 
+// Like Type, this does not depend on R. The dispatch is a
+// dyntrace_dispatch_t stored as an int.
 class CallTrace {
 
     public:
-    explicit CallTrace(std::string pname, std::string fname, function_id_t fn_id, dyntrace_dispatch_t dispatch, int uid) :
+    explicit CallTrace(std::string pname, std::string fname, function_id_t fn_id, int dispatch, int uid) :
     pkg_name_(pname), fun_name_(fname), fn_id_(fn_id), dispatch_(dispatch), uid_(uid) { }
 
     CallTrace(CallTrace* ct) {
@@ -25,10 +28,10 @@ class CallTrace {
         pkg_name_ = "";
         fun_name_ = "";
         fn_id_ = "";
-        dispatch_ = DYNTRACE_DISPATCH_NONE;
+        dispatch_ = 0; /* DYNTRACE_DISPATCH_NONE */
     }
 
-    std::string get_function_name() const {
+    const std::string& get_function_name() const {
         return fun_name_;
     }
 
@@ -36,7 +39,7 @@ class CallTrace {
         fun_name_ = fname;
     }
 
-    std::string get_package_name() const {
+    const std::string& get_package_name() const {
         return pkg_name_;
     }
 
@@ -44,7 +47,7 @@ class CallTrace {
         pkg_name_ = pname;
     }
 
-    function_id_t get_fn_id() {
+    const function_id_t& get_fn_id() const {
         return fn_id_;
     }
 
@@ -52,11 +55,11 @@ class CallTrace {
         fn_id_ = fn_id;
     }
 
-    dyntrace_dispatch_t get_dispatch_type() const {
+    int get_dispatch_type() const {
         return dispatch_;
     }
 
-    void set_dispatch_type(dyntrace_dispatch_t n) {
+    void set_dispatch_type(int n) {
         dispatch_ = n;
     }
 
@@ -64,6 +67,10 @@ class CallTrace {
         return call_trace_;
     }
 
+    const std::unordered_map<int, Type> & get_call_trace() const {
+        return call_trace_;
+    }
+
     void add_to_call_trace(int ppos, Type ptype) {
         call_trace_.insert_or_assign(ppos, ptype);
     }
@@ -84,7 +91,7 @@ class CallTrace {
         size_t the_hash = ((std::hash<std::string>()(fun_name_)
                            ^ (std::hash<std::string>()(pkg_name_) << 1)) >> 1)
                            ^ (std::hash<std::string>()(fn_id_) << 1) >> 1
-                           ^ (std::hash<dyntrace_dispatch_t>()(dispatch_) << 1) >> 1;
+                           ^ (std::hash<int>()(dispatch_) << 1) >> 1;
         
         // need to do a commutative operation cause we arent guaranteed the order here
         the_hash *= compute_hash_just_for_types();
@@ -103,7 +110,18 @@ class CallTrace {
         return the_hash;
     }
 
-    int get_uid() {
+    /* approximate number of bytes used by this trace */
+    std::size_t get_approximate_size() const {
+        std::size_t size = sizeof(CallTrace) + get_heap_size(pkg_name_) +
+                           get_heap_size(fun_name_) + get_heap_size(fn_id_) +
+                           get_hash_table_overhead(call_trace_);
+        for (const auto& binding: call_trace_) {
+            size += sizeof(binding.first) + binding.second.get_approximate_size();
+        }
+        return size;
+    }
+
+    int get_uid() const {
         return uid_;
     }
 
@@ -121,7 +139,7 @@ class CallTrace {
     std::string pkg_name_;
     std::string fun_name_;
     function_id_t fn_id_;
-    dyntrace_dispatch_t dispatch_;
+    int dispatch_;
     std::unordered_map<int, Type> call_trace_;
 
 };
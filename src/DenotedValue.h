@@ -28,8 +28,8 @@ class DenotedValue {
         , default_(false)
         , evaluated_(false)
         , was_argument_(false)
-        , creation_scope_(UNASSIGNED_SCOPE)
-        , forcing_scope_(UNASSIGNED_SCOPE)
+        , creation_scope_(&UNASSIGNED_SCOPE)
+        , forcing_scope_(&UNASSIGNED_SCOPE)
         , class_name_(UNASSIGNED_CLASS_NAME)
         , S3_dispatch_count_(0)
         , S4_dispatch_count_(0)
@@ -207,21 +207,23 @@ class DenotedValue {
                          const Argument* argument);
 
     const scope_t& get_creation_scope() const {
-        return creation_scope_;
+        return *creation_scope_;
     }
 
-    void set_creation_scope(const scope_t& creation_scope) {
+    /* scopes are interned, they are the ids of functions, which live as
+       long as the tracer, or the scope constants */
+    void set_creation_scope(const scope_t* creation_scope) {
         creation_scope_ = creation_scope;
     }
 
-    void set_forcing_scope_if_unset(const scope_t& forcing_scope) {
-        if (forcing_scope_ == UNASSIGNED_SCOPE) {
+    void set_forcing_scope_if_unset(const scope_t* forcing_scope) {
+        if (forcing_scope_ == &UNASSIGNED_SCOPE) {
             forcing_scope_ = forcing_scope;
         }
     }
 
     const scope_t& get_forcing_scope() const {
-        return forcing_scope_;
+        return *forcing_scope_;
     }
 
     const std::string& get_class_name() const {
@@ -792,8 +794,8 @@ class DenotedValue {
     bool default_;
     bool evaluated_;
     bool was_argument_;
-    scope_t creation_scope_;
-    scope_t forcing_scope_;
+    const scope_t* creation_scope_;
+    const scope_t* forcing_scope_;
     std::string class_name_;
     int S3_dispatch_count_;
     int S4_dispatch_count_;
@@ -1,6 +1,11 @@
 #ifndef PROMISEDYNTRACER_DEPENDENCY_NODE_H
 #define PROMISEDYNTRACER_DEPENDENCY_NODE_H
 
+#include "definitions.h"
+
+#include <functional>
+#include <tuple>
+
 class DependencyNode {
 
   public:
@@ -9,7 +14,7 @@ class DependencyNode {
   }
 
   explicit DependencyNode(const function_id_t & fn_id, int param_pos, std::size_t trace_hash) :
-    fn_id_(fn_id), param_pos_(param_pos), trace_hash_(trace_hash) {};
+    fn_id_(fn_id), trace_hash_(trace_hash), param_pos_(param_pos) {};
 
   const function_id_t & get_function_id() const {
     return fn_id_;
@@ -33,9 +38,10 @@ class DependencyNode {
     return ! operator==(node);
   }
 
+  // lexicographic, so that it is a strict weak ordering consistent with ==
   bool operator<(const DependencyNode & node) const {
-    return get_function_id() < node.get_function_id() ||
-           get_formal_parameter_position() < node.get_formal_parameter_position();
+    return std::tie(fn_id_, param_pos_, trace_hash_) <
+           std::tie(node.fn_id_, node.param_pos_, node.trace_hash_);
   }
 
   private:
@@ -2,150 +2,221 @@
 #define PROMISEDYNTRACER_DEPENDENCY_NODE_GRAPH_H
 
 #include "DependencyNode.h"
-
-#include <sstream> // for serializing
-#include <string>  // for serializing
+#include "OutputBuffer.h"
+#include "PointerMap.h"
+#include "footprint.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+typedef struct SEXPREC* SEXP;
+
+// Which (function, position) nodes values flow between. Two nodes depend on
+// each other if a value was seen at both, directly or through other nodes,
+// so the graph is kept as the partition of the nodes in connected components
+// with a union-find over interned nodes. A value only has to remember the
+// last node it was seen at: joining the new node with it joins it with all
+// the nodes the value was seen at before.
+//
+// The direct edges, between consecutive nodes a value was seen at, can be
+// counted as well. That costs a hash table lookup per argument, everything
+// else is O(α(n)). The values are kept in an open addressing table, which
+// is cheap to update on every argument and every gc_unmark.
+//
+// The graph is written as a binary edge list, with strings as a 32 bit
+// length followed by the bytes and integers in host byte order:
+//
+//   magic (8 bytes) | version (32 bits)
+//   | node count (32 bits) | nodes... | edge count (64 bits) | edges...
+//
+// where a node is
+//
+//   fn_id | position (32 bits, -1 for the return value)
+//   | trace hash (64 bits, 0 if none) | component (32 bits)
+//
+// with the component the index of the representative node, and an edge
+//
+//   from (32 bits) | to (32 bits) | value count (64 bits)
+//
+// between node indices.
+namespace dependency_graph_file {
+
+const char MAGIC[8] = {'P', 'R', 'O', 'P', 'D', 'E', 'P', 'S'};
+const std::uint32_t VERSION = 1;
+
+} // namespace dependency_graph_file
 
 class DependencyNodeGraph {
 
 public:
-  explicit DependencyNodeGraph() {}
-
-  void add_argument(SEXP value, function_id_t fn_id, int param_pos) {
-    /*
-        some things that we need to check:
-        - is the argument already in the table? then add edges w.r.t. all other positiongs
-        - if it's a return value, want to add a dependency cause it can become an argument
-          to something else
-    */
-
-    auto iter = arguments_.find(value);
-    DependencyNode new_node(fn_id, param_pos);
-
-    if (iter != arguments_.end()) {
-      // it was present
-
-      for (const DependencyNode & node : iter->second) {
-        add_dependency_(new_node, node);
-      }
-
-      // handles adding to arguments_ list
-      iter->second.insert(new_node);
-    } else {
-      // not present, add for first time
-      arguments_.insert({value, {new_node}});
-    }
+  typedef std::uint32_t node_id_t;
 
-    // in case the argument was the return of some other function, figure that out
-    // it's dealt with actually
+  explicit DependencyNodeGraph(bool count_edges = true):
+    count_edges_(count_edges), component_count_(0) {}
+
+  void add_argument(SEXP value, const function_id_t& fn_id, int param_pos) {
+    add_node_(value, DependencyNode(fn_id, param_pos));
   }
 
   // for tracking traces
-  void add_argument(SEXP value, function_id_t fn_id, int param_pos, std::size_t trace_hash) {
-    /*
-        some things that we need to check:
-        - is the argument already in the table? then add edges w.r.t. all other positiongs
-        - if it's a return value, want to add a dependency cause it can become an argument
-          to something else
-    */
-
-    auto iter = arguments_.find(value);
-    DependencyNode new_node(fn_id, param_pos, trace_hash);
-
-    if (iter != arguments_.end()) {
-      // it was present
-
-      for (const DependencyNode & node : iter->second) {
-        add_dependency_(new_node, node);
-      }
-
-      // handles adding to arguments_ list
-      iter->second.insert(new_node);
-    } else {
-      // not present, add for first time
-      arguments_.insert({value, {new_node}});
-    }
-
-    // in case the argument was the return of some other function, figure that out
-    // it's dealt with actually
+  void add_argument(SEXP value, const function_id_t& fn_id, int param_pos, std::size_t trace_hash) {
+    add_node_(value, DependencyNode(fn_id, param_pos, trace_hash));
   }
 
   // param_pos is -1 for return values
-  void add_return(SEXP value, function_id_t fn_id) {
+  void add_return(SEXP value, const function_id_t& fn_id) {
     // lmao
     add_argument(value, fn_id, -1);
   }
 
   // for tracking return types
-  void add_return(SEXP value, function_id_t fn_id, std::size_t trace_hash) {
+  void add_return(SEXP value, const function_id_t& fn_id, std::size_t trace_hash) {
     // lmao
     add_argument(value, fn_id, -1, trace_hash);
   }
 
   // for things that get gcd
   void remove_value(SEXP value) {
-    // dependencies_ will still have the dependencies tracked
-    arguments_.erase(value);
+    // the components and edges stay
+    values_.erase(value);
   }
 
-  std::stringstream serialize() {
-    
-    int size_of_dependencies_as_int = dependencies_.size();
-    std::stringstream out;
-    
-    std::stringstream add_me, add_me_too;
-
-    // for each node 
-    // (fn_id, p_pos) : (fn_id, p_pos) - (fn_id, p_pos) - ... - (fn_id, p_pos)
-    for ( auto iter = dependencies_.begin(); iter != dependencies_.end(); ++iter) {
-      // serialize the node
-      
-      add_me.str(std::string());
-
-      if (iter->first.get_trace_hash() != 0) {
-        add_me << "," << iter->first.get_trace_hash();
-      }
+  // for when values can have been gcd without remove_value, the components
+  // and edges stay
+  void remove_values() {
+    PointerMap<SEXP, node_id_t>().swap(values_);
+  }
 
-      add_me << " : ";
+  // the representative of the component of node
+  node_id_t find(node_id_t node) {
+    // path halving
+    while (parents_[node] != node) {
+      parents_[node] = parents_[parents_[node]];
+      node = parents_[node];
+    }
+    return node;
+  }
 
-      out << iter->first.get_function_id() << "," << iter->first.get_formal_parameter_position() << add_me.rdbuf();
+  const DependencyNode& get_node(node_id_t node) const {
+    return nodes_[node];
+  }
 
-      // TODO serialize the edges
-      for ( auto edge_iter = iter->second.begin(); edge_iter != iter->second.end(); /* ++edge_iter */) {
+  // number of values currently tracked as arguments or return values
+  std::size_t get_value_count() const {
+    return values_.size();
+  }
 
-        add_me_too.str(std::string());
+  std::size_t get_node_count() const {
+    return nodes_.size();
+  }
 
-        add_me_too << edge_iter->get_formal_parameter_position();
+  std::size_t get_component_count() const {
+    return component_count_;
+  }
 
-        if (edge_iter->get_trace_hash() != 0) {
-          add_me_too << "," << edge_iter->get_trace_hash();
-        }
+  // number of distinct direct edges, 0 unless they are counted
+  std::size_t get_edge_count() const {
+    return edge_counts_.size();
+  }
 
-        out << edge_iter->get_function_id() << "," << add_me_too.rdbuf();
-        if (++edge_iter != iter->second.end()) {
-          out << " - ";
-        }
-      }
+  std::size_t get_approximate_size() const {
+    std::size_t node_bytes = 0;
+    for (const DependencyNode& node: nodes_) {
+      node_bytes += sizeof(DependencyNode) + get_heap_size(node.get_function_id());
+    }
+    return values_.get_approximate_size() +
+           get_hash_table_overhead(node_ids_) +
+           node_ids_.size() * sizeof(std::pair<const DependencyNode, node_id_t>) +
+           node_bytes * 2 /* in nodes_ and as keys of node_ids_ */ +
+           parents_.capacity() * sizeof(node_id_t) +
+           sizes_.capacity() * sizeof(node_id_t) +
+           get_hash_table_overhead(edge_counts_) +
+           edge_counts_.size() * sizeof(std::pair<const std::uint64_t, std::uint64_t>);
+  }
 
-      out << "\n";
+  // Write the graph to filepath, see above for the format.
+  void serialize(const std::string& filepath) {
+    OutputBuffer out(filepath);
+    out.append(dependency_graph_file::MAGIC, sizeof(dependency_graph_file::MAGIC));
+    out.append_bytes(dependency_graph_file::VERSION);
+
+    out.append_bytes<std::uint32_t>(nodes_.size());
+    for (node_id_t id = 0; id < nodes_.size(); ++id) {
+      const DependencyNode& node = nodes_[id];
+      out.append_bytes<std::uint32_t>(node.get_function_id().size());
+      out.append(node.get_function_id());
+      out.append_bytes<std::int32_t>(node.get_formal_parameter_position());
+      out.append_bytes<std::uint64_t>(node.get_trace_hash());
+      out.append_bytes<std::uint32_t>(find(id));
     }
 
-    return out;
+    out.append_bytes<std::uint64_t>(edge_counts_.size());
+    for (const auto& edge: edge_counts_) {
+      out.append_bytes<std::uint32_t>(edge.first >> 32);
+      out.append_bytes<std::uint32_t>(edge.first & 0xFFFFFFFF);
+      out.append_bytes<std::uint64_t>(edge.second);
+    }
 
+    out.close();
   }
 
 private:
-  std::unordered_map<SEXP, std::set<DependencyNode>> arguments_;
-  std::unordered_map<DependencyNode, std::set<DependencyNode>, DependencyNodeHasher> dependencies_;
+  const bool count_edges_;
+  // the last node each live value was seen at
+  PointerMap<SEXP, node_id_t> values_;
+  std::unordered_map<DependencyNode, node_id_t, DependencyNodeHasher> node_ids_;
+  std::vector<DependencyNode> nodes_;
+  // the union-find, by size with path halving
+  std::vector<node_id_t> parents_;
+  std::vector<node_id_t> sizes_;
+  std::size_t component_count_;
+  // (from << 32 | to) to the number of values that went from one to the other
+  std::unordered_map<std::uint64_t, std::uint64_t> edge_counts_;
+
+  node_id_t intern_(const DependencyNode& node) {
+    auto inserted = node_ids_.insert({node, static_cast<node_id_t>(nodes_.size())});
+    if (inserted.second) {
+      nodes_.push_back(node);
+      parents_.push_back(inserted.first->second);
+      sizes_.push_back(1);
+      ++component_count_;
+    }
+    return inserted.first->second;
+  }
 
-  void add_dependency_(DependencyNode key, DependencyNode value) {
-    auto iter = dependencies_.find(key);
+  void union_(node_id_t a, node_id_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) {
+      return;
+    }
+    if (sizes_[a] < sizes_[b]) {
+      std::swap(a, b);
+    }
+    parents_[b] = a;
+    sizes_[a] += sizes_[b];
+    --component_count_;
+  }
 
-    if (iter == dependencies_.end()) {
-      // first time
-      dependencies_.insert({key, {value}});
-    } else {
-      iter->second.insert(value);
+  void add_node_(SEXP value, const DependencyNode& node) {
+    node_id_t id = intern_(node);
+    auto inserted = values_.insert(value, id);
+    if (inserted.second) {
+      // first time the value is seen
+      return;
+    }
+
+    node_id_t previous = *inserted.first;
+    *inserted.first = id;
+    if (previous == id) {
+      return;
+    }
+    union_(previous, id);
+    if (count_edges_) {
+      ++edge_counts_[(static_cast<std::uint64_t>(previous) << 32) | id];
     }
   }
 
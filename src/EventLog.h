@@ -0,0 +1,330 @@
+#ifndef TYPEDYNTRACER_EVENT_LOG_H
+#define TYPEDYNTRACER_EVENT_LOG_H
+
+#include "CallTrace.h"
+#include "TypeTable.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Binary log of the calls seen by the tracer, which can be replayed through
+// the analysis without R (see tools/replay). All integers are 32 bits in
+// host byte order. The log starts with
+//
+//   magic (8 bytes) | version | package under analysis (string)
+//
+// followed by records, each starting with a one byte kind:
+//
+//   STRING  length | bytes
+//   TYPE    top level type | sexptype name | tag count | tags...
+//           | class count | classes... | attribute count | attributes...
+//   CALL    context id | package | function name | function id | dispatch
+//           (1 byte) | flags (1 byte) | argument count
+//           | (position (-1 is the return value) | type)...
+//
+// Strings and types are interned, the i-th STRING and TYPE records define
+// string i and type i, and are written before the first record using them.
+// A string is written as its length followed by its bytes. The context id
+// of a call is the unique id of its call trace.
+namespace event_log {
+
+const char MAGIC[8] = {'P', 'R', 'O', 'P', 'E', 'V', 'T', 'S'};
+const std::uint32_t VERSION = 1;
+
+enum class RecordKind : std::uint8_t { String = 1, Type = 2, Call = 3 };
+
+const std::uint8_t HAS_DOTS_FLAG = 1;
+const std::uint8_t PRIMITIVE_FLAG = 2;
+
+struct call_record_t {
+    std::uint32_t context_id;
+    std::string package_name;
+    std::string function_name;
+    function_id_t function_id;
+    int dispatch;
+    bool has_dots;
+    /* call of a builtin or special */
+    bool primitive;
+    /* (position, type id) */
+    std::vector<std::pair<int, type_id_t>> arguments;
+};
+
+} // namespace event_log
+
+class EventLogWriter {
+  public:
+    /* sexptype_name gives the name of the sexptype of types made from
+       values, which replay uses to reduce types to their sexptype */
+    explicit EventLogWriter(
+        const std::string& filepath,
+        const std::string& package_under_analysis,
+        std::function<std::string(sexptype_t)> sexptype_name)
+        : buffer_(BUFFER_SIZE), sexptype_name_(sexptype_name) {
+        fout_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+        fout_.open(filepath, std::ios::binary | std::ios::trunc);
+        fout_.write(event_log::MAGIC, sizeof(event_log::MAGIC));
+        write_uint32_(event_log::VERSION);
+        write_string_(package_under_analysis);
+    }
+
+    ~EventLogWriter() {
+        close();
+    }
+
+    void write_call(const CallTrace& trace, bool primitive) {
+        const std::unordered_map<int, Type>& types = trace.get_call_trace();
+
+        /* the strings and types used by the call have to be defined before
+           it */
+        std::uint32_t package_name = intern_string_(trace.get_package_name());
+        std::uint32_t function_name = intern_string_(trace.get_function_name());
+        std::uint32_t function_id = intern_string_(trace.get_fn_id());
+        arguments_.clear();
+        for (const auto& binding: types) {
+            arguments_.push_back({binding.first, intern_type_(binding.second)});
+        }
+
+        write_kind_(event_log::RecordKind::Call);
+        write_uint32_(trace.get_uid());
+        write_uint32_(package_name);
+        write_uint32_(function_name);
+        write_uint32_(function_id);
+        write_uint8_(trace.get_dispatch_type());
+        write_uint8_((trace.get_has_dots() ? event_log::HAS_DOTS_FLAG : 0) |
+                     (primitive ? event_log::PRIMITIVE_FLAG : 0));
+        write_uint32_(arguments_.size());
+        for (const auto& argument: arguments_) {
+            write_uint32_(argument.first);
+            write_uint32_(argument.second);
+        }
+    }
+
+    void flush() {
+        fout_.flush();
+    }
+
+    void close() {
+        if (fout_.is_open()) {
+            fout_.close();
+        }
+    }
+
+  private:
+    static const std::size_t BUFFER_SIZE = 1 << 20;
+
+    std::vector<char> buffer_;
+    std::ofstream fout_;
+    std::function<std::string(sexptype_t)> sexptype_name_;
+    std::unordered_map<std::string, std::uint32_t> strings_;
+    TypeTable types_;
+    std::vector<std::pair<int, type_id_t>> arguments_;
+
+    std::uint32_t intern_string_(const std::string& string) {
+        auto iter = strings_.find(string);
+        if (iter != strings_.end()) {
+            return iter->second;
+        }
+        std::uint32_t id = strings_.size();
+        strings_.insert({string, id});
+        write_kind_(event_log::RecordKind::String);
+        write_string_(string);
+        return id;
+    }
+
+    type_id_t intern_type_(const Type& type) {
+        std::size_t type_count = types_.size();
+        type_id_t id = types_.intern(type);
+        if (types_.size() == type_count) {
+            return id;
+        }
+
+        std::string sexptype_name = type.get_sexptype() == Type::UNKNOWN_SEXPTYPE
+                                        ? type.get_top_level_type()
+                                        : sexptype_name_(type.get_sexptype());
+
+        std::vector<std::uint32_t> fields{
+            intern_string_(type.get_top_level_type()),
+            intern_string_(sexptype_name)};
+        for (const std::vector<std::string>& strings:
+             {*type.get_tags(), type.get_classes(), type.get_attr_names()}) {
+            fields.push_back(strings.size());
+            for (const std::string& string: strings) {
+                fields.push_back(intern_string_(string));
+            }
+        }
+
+        write_kind_(event_log::RecordKind::Type);
+        for (std::uint32_t field: fields) {
+            write_uint32_(field);
+        }
+        return id;
+    }
+
+    void write_kind_(event_log::RecordKind kind) {
+        write_uint8_(static_cast<std::uint8_t>(kind));
+    }
+
+    void write_uint8_(std::uint8_t value) {
+        fout_.put(static_cast<char>(value));
+    }
+
+    void write_uint32_(std::uint32_t value) {
+        fout_.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void write_string_(const std::string& string) {
+        write_uint32_(string.size());
+        fout_.write(string.data(), string.size());
+    }
+};
+
+// Reads the calls of an event log back, resolving the interned strings.
+// Throws std::runtime_error if the log is malformed.
+class EventLogReader {
+  public:
+    explicit EventLogReader(const std::string& filepath)
+        : buffer_(BUFFER_SIZE) {
+        fin_.rdbuf()->pubsetbuf(buffer_.data(), buffer_.size());
+        fin_.open(filepath, std::ios::binary);
+        if (!fin_) {
+            throw std::runtime_error("unable to open " + filepath);
+        }
+
+        char magic[sizeof(event_log::MAGIC)];
+        fin_.read(magic, sizeof(magic));
+        if (!fin_ || std::memcmp(magic, event_log::MAGIC, sizeof(magic))) {
+            throw std::runtime_error(filepath + " is not an event log");
+        }
+        std::uint32_t version = read_uint32_();
+        if (version != event_log::VERSION) {
+            throw std::runtime_error("unsupported event log version " +
+                                     std::to_string(version));
+        }
+        package_under_analysis_ = read_string_();
+    }
+
+    const std::string& get_package_under_analysis() const {
+        return package_under_analysis_;
+    }
+
+    const Type& get_type(type_id_t id) const {
+        return types_.at(id);
+    }
+
+    const std::string& get_sexptype_name(type_id_t id) const {
+        return sexptype_names_.at(id);
+    }
+
+    /* reads the next call, returns false at the end of the log */
+    bool next(event_log::call_record_t& call) {
+        int kind;
+        while ((kind = fin_.get()) != std::char_traits<char>::eof()) {
+            switch (static_cast<event_log::RecordKind>(kind)) {
+            case event_log::RecordKind::String:
+                strings_.push_back(read_string_());
+                break;
+            case event_log::RecordKind::Type:
+                read_type_();
+                break;
+            case event_log::RecordKind::Call:
+                read_call_(call);
+                return true;
+            default:
+                throw std::runtime_error("unknown record kind " +
+                                         std::to_string(kind));
+            }
+        }
+        return false;
+    }
+
+  private:
+    static const std::size_t BUFFER_SIZE = 1 << 20;
+
+    std::vector<char> buffer_;
+    std::ifstream fin_;
+    std::string package_under_analysis_;
+    std::vector<std::string> strings_;
+    std::vector<Type> types_;
+    std::vector<std::string> sexptype_names_;
+
+    void read_call_(event_log::call_record_t& call) {
+        call.context_id = read_uint32_();
+        call.package_name = read_interned_string_();
+        call.function_name = read_interned_string_();
+        call.function_id = read_interned_string_();
+        call.dispatch = read_uint8_();
+        std::uint8_t flags = read_uint8_();
+        call.has_dots = flags & event_log::HAS_DOTS_FLAG;
+        call.primitive = flags & event_log::PRIMITIVE_FLAG;
+        std::uint32_t argument_count = read_uint32_();
+        call.arguments.clear();
+        for (std::uint32_t i = 0; i < argument_count; ++i) {
+            int position = static_cast<std::int32_t>(read_uint32_());
+            type_id_t type_id = read_uint32_();
+            if (static_cast<std::size_t>(type_id) >= types_.size()) {
+                throw std::runtime_error("undefined type " +
+                                         std::to_string(type_id));
+            }
+            call.arguments.push_back({position, type_id});
+        }
+    }
+
+    void read_type_() {
+        Type type(read_interned_string_());
+        sexptype_names_.push_back(read_interned_string_());
+        *type.get_tags() = read_interned_strings_();
+        type.set_classes(read_interned_strings_());
+        type.set_attr_names(read_interned_strings_());
+        types_.push_back(type);
+    }
+
+    std::vector<std::string> read_interned_strings_() {
+        std::vector<std::string> strings(read_uint32_());
+        for (std::string& string: strings) {
+            string = read_interned_string_();
+        }
+        return strings;
+    }
+
+    const std::string& read_interned_string_() {
+        std::uint32_t id = read_uint32_();
+        if (id >= strings_.size()) {
+            throw std::runtime_error("undefined string " + std::to_string(id));
+        }
+        return strings_[id];
+    }
+
+    std::uint8_t read_uint8_() {
+        int value = fin_.get();
+        if (value == std::char_traits<char>::eof()) {
+            throw std::runtime_error("truncated event log");
+        }
+        return value;
+    }
+
+    std::uint32_t read_uint32_() {
+        std::uint32_t value;
+        fin_.read(reinterpret_cast<char*>(&value), sizeof(value));
+        if (!fin_) {
+            throw std::runtime_error("truncated event log");
+        }
+        return value;
+    }
+
+    std::string read_string_() {
+        std::string string(read_uint32_(), '\0');
+        fin_.read(&string[0], string.size());
+        if (!fin_) {
+            throw std::runtime_error("truncated event log");
+        }
+        return string;
+    }
+};
+
+#endif /* TYPEDYNTRACER_EVENT_LOG_H */
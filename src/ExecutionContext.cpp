@@ -3,5 +3,8 @@
 #include "Function.h"
 
 ExecutionContext::ExecutionContext(Call* call)
-    : type_(call->get_function()->get_type()), call_(call), execution_time_(0) {
+    : type_(call->get_function()->get_type())
+    , call_(call)
+    , execution_time_(0)
+    , callee_execution_time_(0) {
 }
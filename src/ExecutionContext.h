@@ -10,11 +10,17 @@ class Call;
 class ExecutionContext {
   public:
     explicit ExecutionContext(DenotedValue* promise_state)
-        : type_(PROMSXP), promise_state_(promise_state), execution_time_(0) {
+        : type_(PROMSXP)
+        , promise_state_(promise_state)
+        , execution_time_(0)
+        , callee_execution_time_(0) {
     }
 
     explicit ExecutionContext(const RCNTXT* r_context)
-        : type_(CONTEXTSXP), r_context_(r_context), execution_time_(0) {
+        : type_(CONTEXTSXP)
+        , r_context_(r_context)
+        , execution_time_(0)
+        , callee_execution_time_(0) {
     }
 
     /* defined in cpp file to get around cyclic dependency issues. */
@@ -76,6 +82,20 @@ class ExecutionContext {
         return execution_time_;
     }
 
+    /* time spent in calls made from this context, either directly or through
+       promises and R contexts. this is included in the execution time. */
+    void increment_callee_execution_time(const std::uint64_t increment) {
+        callee_execution_time_ += increment;
+    }
+
+    std::uint64_t get_callee_execution_time() const {
+        return callee_execution_time_;
+    }
+
+    std::uint64_t get_exclusive_execution_time() const {
+        return execution_time_ - callee_execution_time_;
+    }
+
   private:
     sexptype_t type_;
     union {
@@ -84,6 +104,7 @@ class ExecutionContext {
         const RCNTXT* r_context_;
     };
     std::uint64_t execution_time_;
+    std::uint64_t callee_execution_time_;
 };
 
 using execution_contexts_t = std::vector<ExecutionContext>;
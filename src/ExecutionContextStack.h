@@ -3,6 +3,8 @@
 
 #include "ExecutionContext.h"
 
+#include <cassert>
+#include <limits>
 #include <vector>
 
 using execution_contexts_t = std::vector<ExecutionContext>;
@@ -14,6 +16,9 @@ class ExecutionContextStack {
     using const_iterator = execution_contexts_t::const_iterator;
     using const_reverse_iterator = execution_contexts_t::const_reverse_iterator;
 
+    /* the scope index of frames with no scope below them */
+    static const std::size_t NO_SCOPE = std::numeric_limits<std::size_t>::max();
+
     explicit ExecutionContextStack(): stack_() {
     }
 
@@ -57,43 +62,83 @@ class ExecutionContextStack {
         return stack_.crend();
     }
 
+    /* promises and R contexts, which are not scopes */
     template <typename T>
     void push(T* context) {
         stack_.push_back(ExecutionContext(context));
+        scope_indices_.push_back(get_scope_index());
+    }
+
+    /* calls are scopes unless is_scope is false, e.g. for '{' */
+    void push(Call* call, bool is_scope) {
+        stack_.push_back(ExecutionContext(call));
+        scope_indices_.push_back(is_scope ? stack_.size() - 1
+                                          : get_scope_index());
     }
 
     ExecutionContext pop() {
-        ExecutionContext context{peek(1)};
+        ExecutionContext context{top()};
         stack_.pop_back();
+        scope_indices_.pop_back();
         return context;
     }
 
+    // The index of the nearest call on the stack that is a scope, or
+    // NO_SCOPE. Each frame keeps the index of the nearest scope at or below
+    // it, so this does not walk the stack.
+    std::size_t get_scope_index() const {
+        return scope_indices_.empty() ? NO_SCOPE : scope_indices_.back();
+    }
+
+    /* unchecked, the stack must not be empty */
+    ExecutionContext& top() {
+        assert(!stack_.empty());
+        return stack_.back();
+    }
+
+    /* unchecked unless assertions are enabled, like the accessors below */
     const ExecutionContext& peek(std::size_t n = 1) const {
-        return stack_.at(stack_.size() - n);
+        assert(n >= 1 && n <= stack_.size());
+        return stack_[stack_.size() - n];
     }
 
     ExecutionContext& peek(std::size_t n = 1) {
-        return stack_.at(stack_.size() - n);
+        assert(n >= 1 && n <= stack_.size());
+        return stack_[stack_.size() - n];
     }
 
-    execution_contexts_t unwind(const ExecutionContext& context) {
-        execution_contexts_t unwound_contexts;
-
-        while (size() > 0) {
-            ExecutionContext& temp_context{stack_.back()};
+    /* from the bottom of the stack */
+    ExecutionContext& operator[](std::size_t index) {
+        assert(index < stack_.size());
+        return stack_[index];
+    }
 
-            if (temp_context.is_r_context() &&
-                (temp_context.get_r_context() == context.get_r_context())) {
-                return unwound_contexts;
+    // The size of the stack once unwound to the R context of context, which
+    // stays on top. The contexts above it are left in place, so that they
+    // can be processed without being copied before the stack is truncated.
+    std::size_t find_unwind_size(const ExecutionContext& context) const {
+        for (std::size_t size = stack_.size(); size > 0; --size) {
+            const ExecutionContext& candidate = stack_[size - 1];
+            if (candidate.is_r_context() &&
+                (candidate.get_r_context() == context.get_r_context())) {
+                return size;
             }
-            stack_.pop_back();
-            unwound_contexts.push_back(temp_context);
         }
         dyntrace_log_error("cannot find matching context while unwinding\n");
+        return stack_.size();
+    }
+
+    /* drops the contexts above size */
+    void truncate(std::size_t size) {
+        assert(size <= stack_.size());
+        stack_.erase(stack_.begin() + size, stack_.end());
+        scope_indices_.resize(size);
     }
 
   private:
     execution_contexts_t stack_;
+    /* for each frame, see get_scope_index */
+    std::vector<std::size_t> scope_indices_;
 };
 
 #endif
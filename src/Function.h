@@ -3,8 +3,10 @@
 
 #include "Call.h"
 #include "Rinternals.h"
+#include "TypingMode.h"
 #include "sexptypes.h"
 
+#include <algorithm>
 #include <fstream>
 
 class Function {
@@ -17,7 +19,13 @@ class Function {
         , wrapper_(true)
         , namespace_(package_name)
         , definition_(definition)
-        , id_(id) {
+        , id_(id)
+        , typing_mode_(TypingMode::Full)
+        , call_count_(0)
+        , active_call_count_(0)
+        , max_call_depth_(0)
+        , inclusive_execution_time_(0)
+        , exclusive_execution_time_(0) {
         type_ = type_of_sexp(op);
 
         if (type_ == CLOSXP) {
@@ -111,6 +119,48 @@ class Function {
         return id_;
     }
 
+    TypingMode get_typing_mode() const {
+        return typing_mode_;
+    }
+
+    void set_typing_mode(TypingMode typing_mode) {
+        typing_mode_ = typing_mode;
+    }
+
+    /* call_depth is the number of calls on the stack, including this one */
+    void enter_call(int call_depth) {
+        ++active_call_count_;
+        max_call_depth_ = std::max(max_call_depth_, call_depth);
+    }
+
+    /* times are in cycle counter ticks, see timing.h */
+    void exit_call(std::uint64_t inclusive_execution_time,
+                   std::uint64_t exclusive_execution_time) {
+        --active_call_count_;
+        exclusive_execution_time_ += exclusive_execution_time;
+        /* the time of recursive calls is already included in the
+           outermost one */
+        if (active_call_count_ == 0) {
+            inclusive_execution_time_ += inclusive_execution_time;
+        }
+    }
+
+    int get_call_count() const {
+        return call_count_;
+    }
+
+    int get_max_call_depth() const {
+        return max_call_depth_;
+    }
+
+    std::uint64_t get_inclusive_execution_time() const {
+        return inclusive_execution_time_;
+    }
+
+    std::uint64_t get_exclusive_execution_time() const {
+        return exclusive_execution_time_;
+    }
+
     const std::string& get_definition() const {
         return definition_;
     }
@@ -123,9 +173,19 @@ class Function {
         return names_;
     }
 
+    /* approximate number of bytes used by this function, mostly the
+       deparsed definition */
+    std::size_t get_approximate_size() const {
+        return sizeof(Function) + get_heap_size(namespace_) +
+               get_heap_size(definition_) + get_heap_size(id_) +
+               get_heap_size(names_);
+    }
+
     void add_summary(Call* call) {
         int i;
 
+        ++call_count_;
+
         for (i = 0; i < names_.size(); ++i) {
             if (names_[i] == call->get_function_name()) {
                 break;
@@ -171,6 +231,12 @@ class Function {
     function_id_t id_;
     int primitive_offset_;
     bool byte_compiled_;
+    TypingMode typing_mode_;
+    int call_count_;
+    int active_call_count_;
+    int max_call_depth_;
+    std::uint64_t inclusive_execution_time_;
+    std::uint64_t exclusive_execution_time_;
 
     std::vector<std::string> names_;
 
@@ -0,0 +1,64 @@
+#ifndef TYPEDYNTRACER_MAPPED_FILE_H
+#define TYPEDYNTRACER_MAPPED_FILE_H
+
+#include <cstddef>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A read-only mapping of a whole file.
+class MappedFile {
+  public:
+    explicit MappedFile(const std::string& filepath)
+        : data_(nullptr), size_(0) {
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw std::runtime_error("unable to open " + filepath);
+        }
+
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) == -1) {
+            close(fd);
+            throw std::runtime_error("unable to stat " + filepath);
+        }
+        size_ = file_stat.st_size;
+
+        if (size_ != 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("unable to map " + filepath);
+            }
+            /* the rows are read once, front to back */
+            madvise(data, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(data);
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    const char* begin() const {
+        return data_;
+    }
+
+    const char* end() const {
+        return data_ + size_;
+    }
+
+  private:
+    const char* data_;
+    std::size_t size_;
+};
+
+#endif /* TYPEDYNTRACER_MAPPED_FILE_H */
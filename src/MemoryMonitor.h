@@ -0,0 +1,71 @@
+#ifndef PROMISEDYNTRACER_MEMORY_MONITOR_H
+#define PROMISEDYNTRACER_MEMORY_MONITOR_H
+
+#include "definitions.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Live objects and approximate bytes held by one of the tracer's data
+// structures. The bytes are an estimate: the sizes of the objects, their
+// strings and the bookkeeping of the containers holding them, but not the
+// allocator's own overhead.
+struct memory_usage_t {
+    std::string structure;
+    std::size_t objects;
+    std::size_t bytes;
+};
+
+// Writes the memory usage of the tracer's data structures to a time series
+// file, one row per structure and sample:
+//
+//   timestamp,gc_cycle,structure,objects,bytes
+//
+// A sample is taken every sampling_interval events; 0 turns sampling off.
+class MemoryMonitor {
+  public:
+    explicit MemoryMonitor(std::size_t sampling_interval)
+        : sampling_interval_(sampling_interval) {
+    }
+
+    std::size_t get_sampling_interval() const {
+        return sampling_interval_;
+    }
+
+    bool is_sampling_due(timestamp_t timestamp) const {
+        return sampling_interval_ != 0 && timestamp % sampling_interval_ == 0;
+    }
+
+    /* the file is created on the first sample, so nothing is written if
+       sampling is off */
+    void sample(const std::string& filepath,
+                timestamp_t timestamp,
+                gc_cycle_t gc_cycle,
+                const std::vector<memory_usage_t>& usages) {
+        if (!fout_.is_open()) {
+            fout_.open(filepath, std::ios::trunc);
+            fout_ << "timestamp,gc_cycle,structure,objects,bytes" << std::endl;
+        }
+
+        for (const memory_usage_t& usage: usages) {
+            fout_ << timestamp << "," << gc_cycle << "," << usage.structure
+                  << "," << usage.objects << "," << usage.bytes << "\n";
+        }
+        fout_.flush();
+    }
+
+    /* turns sampling off for good */
+    void stop() {
+        sampling_interval_ = 0;
+        if (fout_.is_open()) {
+            fout_.close();
+        }
+    }
+
+  private:
+    std::size_t sampling_interval_;
+    std::ofstream fout_;
+};
+
+#endif /* PROMISEDYNTRACER_MEMORY_MONITOR_H */
@@ -0,0 +1,165 @@
+#ifndef TYPEDYNTRACER_OUTPUT_BUFFER_H
+#define TYPEDYNTRACER_OUTPUT_BUFFER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+// A file written in large blocks. Data is appended to chunks allocated once
+// up front, and the chunks are handed to the kernel together with one writev
+// when they are all full, instead of going through an iostream. Numbers are
+// formatted in place with to_chars. Throws std::runtime_error if the file
+// cannot be opened or written.
+class OutputBuffer {
+  public:
+    explicit OutputBuffer(const std::string& filepath,
+                          std::size_t chunk_size = DEFAULT_CHUNK_SIZE,
+                          std::size_t chunk_count = DEFAULT_CHUNK_COUNT)
+        : filepath_(filepath)
+        , chunk_size_(chunk_size)
+        , chunks_(chunk_count)
+        , sizes_(chunk_count, 0)
+        , current_(0) {
+        fd_ = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ == -1) {
+            throw std::runtime_error("unable to open " + filepath + ": " +
+                                     std::strerror(errno));
+        }
+        for (std::unique_ptr<char[]>& chunk: chunks_) {
+            chunk.reset(new char[chunk_size_]);
+        }
+    }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    /* errors are only reported by an explicit close */
+    ~OutputBuffer() {
+        try {
+            close();
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+    void append(const char* data, std::size_t size) {
+        while (size != 0) {
+            std::size_t available = chunk_size_ - sizes_[current_];
+            if (available == 0) {
+                next_chunk_();
+                continue;
+            }
+            std::size_t count = std::min(available, size);
+            std::memcpy(chunks_[current_].get() + sizes_[current_], data, count);
+            sizes_[current_] += count;
+            data += count;
+            size -= count;
+        }
+    }
+
+    void append(std::string_view string) {
+        append(string.data(), string.size());
+    }
+
+    void append(char character) {
+        if (sizes_[current_] == chunk_size_) {
+            next_chunk_();
+        }
+        chunks_[current_][sizes_[current_]++] = character;
+    }
+
+    /* the decimal representation of value */
+    template <typename T>
+    void append_number(T value) {
+        /* enough for any 64 bit integer and its sign */
+        const std::size_t MAX_DIGITS = 21;
+        if (chunk_size_ - sizes_[current_] < MAX_DIGITS) {
+            next_chunk_();
+        }
+        char* begin = chunks_[current_].get() + sizes_[current_];
+        char* end = std::to_chars(begin, begin + MAX_DIGITS, value).ptr;
+        sizes_[current_] += end - begin;
+    }
+
+    /* the bytes of value, in host byte order */
+    template <typename T>
+    void append_bytes(T value) {
+        append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void close() {
+        if (fd_ == -1) {
+            return;
+        }
+        flush_();
+        int fd = fd_;
+        fd_ = -1;
+        if (::close(fd) == -1) {
+            throw std::runtime_error("unable to close " + filepath_ + ": " +
+                                     std::strerror(errno));
+        }
+    }
+
+  private:
+    static const std::size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+    static const std::size_t DEFAULT_CHUNK_COUNT = 8;
+
+    const std::string filepath_;
+    const std::size_t chunk_size_;
+    int fd_;
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    std::vector<std::size_t> sizes_;
+    std::size_t current_;
+
+    void next_chunk_() {
+        if (current_ + 1 == chunks_.size()) {
+            flush_();
+        } else {
+            ++current_;
+        }
+    }
+
+    void flush_() {
+        std::vector<iovec> blocks;
+        for (std::size_t i = 0; i <= current_; ++i) {
+            if (sizes_[i] != 0) {
+                blocks.push_back({chunks_[i].get(), sizes_[i]});
+            }
+            sizes_[i] = 0;
+        }
+        current_ = 0;
+
+        /* writev can write less than asked for */
+        iovec* block = blocks.data();
+        iovec* end = block + blocks.size();
+        while (block != end) {
+            ssize_t written = writev(fd_, block, end - block);
+            if (written == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("unable to write " + filepath_ +
+                                         ": " + std::strerror(errno));
+            }
+            while (block != end &&
+                   static_cast<std::size_t>(written) >= block->iov_len) {
+                written -= block->iov_len;
+                ++block;
+            }
+            if (block != end) {
+                block->iov_base = static_cast<char*>(block->iov_base) + written;
+                block->iov_len -= written;
+            }
+        }
+    }
+};
+
+#endif /* TYPEDYNTRACER_OUTPUT_BUFFER_H */
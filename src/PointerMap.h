@@ -0,0 +1,126 @@
+#ifndef PROMISEDYNTRACER_POINTER_MAP_H
+#define PROMISEDYNTRACER_POINTER_MAP_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// A hash map from non-null pointers to small values, with open addressing
+// and linear probing in a single array. Erasing shifts the following entries
+// back instead of leaving tombstones, so a map that sees many insertions and
+// erasures, like one keyed by R objects that are collected, does not degrade.
+// The table doubles when it is more than half full.
+template <typename K, typename V>
+class PointerMap {
+  public:
+    explicit PointerMap(std::size_t capacity = 1024)
+        : entries_(round_up_(capacity)), size_(0) {
+    }
+
+    /* the value of key, nullptr if it is not in the map */
+    V* find(K key) {
+        std::size_t index = probe_(key);
+        return entries_[index].first == key ? &entries_[index].second
+                                            : nullptr;
+    }
+
+    /* inserts key with value unless it is already in the map, and returns its
+       value and whether it was inserted */
+    std::pair<V*, bool> insert(K key, const V& value) {
+        std::size_t index = probe_(key);
+        if (entries_[index].first == key) {
+            return {&entries_[index].second, false};
+        }
+
+        if (2 * (size_ + 1) > entries_.size()) {
+            grow_();
+            index = probe_(key);
+        }
+
+        entries_[index] = {key, value};
+        ++size_;
+        return {&entries_[index].second, true};
+    }
+
+    bool erase(K key) {
+        std::size_t mask = entries_.size() - 1;
+        std::size_t index = probe_(key);
+        if (entries_[index].first != key) {
+            return false;
+        }
+
+        /* move back the entries that probed past the erased one */
+        std::size_t next = index;
+        while (true) {
+            next = (next + 1) & mask;
+            if (entries_[next].first == nullptr) {
+                break;
+            }
+            std::size_t home = hash_(entries_[next].first) & mask;
+            /* the entry can move to index if index is between its home and
+               where it is, cyclically */
+            if (((next - home) & mask) >= ((next - index) & mask)) {
+                entries_[index] = entries_[next];
+                index = next;
+            }
+        }
+
+        entries_[index] = {nullptr, V()};
+        --size_;
+        return true;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    void swap(PointerMap& other) {
+        entries_.swap(other.entries_);
+        std::swap(size_, other.size_);
+    }
+
+    std::size_t get_approximate_size() const {
+        return entries_.capacity() * sizeof(std::pair<K, V>);
+    }
+
+  private:
+    std::vector<std::pair<K, V>> entries_;
+    std::size_t size_;
+
+    static std::size_t round_up_(std::size_t capacity) {
+        std::size_t size = 16;
+        while (size < capacity) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    /* objects are aligned, the low bits carry no information */
+    static std::size_t hash_(K key) {
+        std::uint64_t bits = reinterpret_cast<std::uintptr_t>(key) >> 3;
+        return (bits * 0x9E3779B97F4A7C15ull) >> 16;
+    }
+
+    /* the slot of key, or the empty slot where it would go */
+    std::size_t probe_(K key) const {
+        std::size_t mask = entries_.size() - 1;
+        std::size_t index = hash_(key) & mask;
+        while (entries_[index].first != key &&
+               entries_[index].first != nullptr) {
+            index = (index + 1) & mask;
+        }
+        return index;
+    }
+
+    void grow_() {
+        std::vector<std::pair<K, V>> entries(entries_.size() * 2);
+        entries.swap(entries_);
+        for (const std::pair<K, V>& entry: entries) {
+            if (entry.first != nullptr) {
+                entries_[probe_(entry.first)] = entry;
+            }
+        }
+    }
+};
+
+#endif /* PROMISEDYNTRACER_POINTER_MAP_H */
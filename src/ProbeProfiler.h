@@ -0,0 +1,103 @@
+#ifndef PROMISEDYNTRACER_PROBE_PROFILER_H
+#define PROMISEDYNTRACER_PROBE_PROFILER_H
+
+#include "Event.h"
+#include "timing.h"
+#include "utilities.h"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <vector>
+
+// Measures the time spent inside each probe, in cycle counter ticks. The
+// measurements of each event are kept in a histogram with logarithmic
+// buckets: bucket 0 counts probes that took 0 ticks and bucket k counts
+// probes that took [2^(k-1), 2^k) ticks.
+class ProbeProfiler {
+  public:
+    static const int BUCKET_COUNT = 65;
+
+    explicit ProbeProfiler()
+        : start_(0), statistics_(to_underlying(Event::COUNT)) {
+    }
+
+    void begin_probe() {
+        start_ = read_cycle_counter();
+    }
+
+    void end_probe(const Event event) {
+        /* DyntraceEntry exits a probe that was never entered */
+        if (start_ == 0) {
+            return;
+        }
+        std::uint64_t ticks = read_cycle_counter() - start_;
+        start_ = 0;
+
+        probe_statistics_t& statistics = statistics_[to_underlying(event)];
+        ++statistics.count;
+        statistics.total_ticks += ticks;
+        statistics.max_ticks = std::max(statistics.max_ticks, ticks);
+        ++statistics.histogram[get_bucket(ticks)];
+    }
+
+    static int get_bucket(std::uint64_t ticks) {
+        return ticks == 0 ? 0 : 64 - __builtin_clzll(ticks);
+    }
+
+    /* event_counts are the per event counts kept by the tracer. These are
+       written even if the probes were not profiled. */
+    void serialize(const std::string& filepath,
+                   const std::vector<unsigned long int>& event_counts,
+                   bool profiled) const {
+        std::ofstream fout(filepath, std::ios::trunc);
+
+        fout << "event,count,profiled_count,total_ticks,max_ticks,histogram"
+             << std::endl;
+
+        for (int index = 0; index < to_underlying(Event::COUNT); ++index) {
+            if (event_counts[index] == 0) {
+                continue;
+            }
+
+            fout << to_string(static_cast<Event>(index)) << ","
+                 << event_counts[index] << ",";
+
+            if (!profiled) {
+                fout << "NA,NA,NA,NA" << std::endl;
+                continue;
+            }
+
+            const probe_statistics_t& statistics = statistics_[index];
+
+            fout << statistics.count << "," << statistics.total_ticks << ","
+                 << statistics.max_ticks << ",";
+
+            /* drop the empty buckets at the end, nothing is that slow */
+            int last = BUCKET_COUNT - 1;
+            while (last > 0 && statistics.histogram[last] == 0) {
+                --last;
+            }
+            for (int bucket = 0; bucket <= last; ++bucket) {
+                fout << statistics.histogram[bucket];
+                if (bucket != last) {
+                    fout << "-";
+                }
+            }
+            fout << std::endl;
+        }
+    }
+
+  private:
+    struct probe_statistics_t {
+        std::uint64_t count = 0;
+        std::uint64_t total_ticks = 0;
+        std::uint64_t max_ticks = 0;
+        std::array<std::uint64_t, BUCKET_COUNT> histogram{};
+    };
+
+    std::uint64_t start_;
+    std::vector<probe_statistics_t> statistics_;
+};
+
+#endif /* PROMISEDYNTRACER_PROBE_PROFILER_H */
@@ -0,0 +1,408 @@
+#ifndef TYPEDYNTRACER_SHARED_TRACE_TABLE_H
+#define TYPEDYNTRACER_SHARED_TRACE_TABLE_H
+
+#include "TraceRecord.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// A trace table in POSIX shared memory, shared by all the processes that
+// open it by name, so traces seen by several processes are stored once per
+// machine and their counts are summed as they are seen, without merging
+// traces files afterwards.
+//
+// The segment has a header, a hash table of slots and an arena of rows:
+//
+//   header | slot... | row...
+//
+// A slot holds the hash of a trace, its count and the offset of its row in
+// the arena, each an atomic updated without locks. The table uses linear
+// probing on the hash, a process claims an empty slot by swapping its hash
+// in, and adds to the count of a slot with the hash it is looking for. A row
+// is the package under analysis and the columns of a trace, written to the
+// arena, which is allocated by bumping its used size, before the slot is
+// claimed and published in the slot after. Only the process that claims a
+// slot renders its row.
+//
+// Traces are identified by hash alone, as in traces files. The hash 0 marks
+// an empty slot, a trace with that hash is kept as 1. Once the slots are 3/4
+// used or the arena is full, the table is full: it still counts the traces
+// it has, but does not take new ones, which the caller has to keep itself.
+//
+// The segment outlives the processes, it is written out with serialize and
+// removed with remove.
+class SharedTraceTable {
+  public:
+    /* attaches to the table called name, creating it with size bytes if it
+       does not exist yet, or failing if size is 0. Throws
+       std::runtime_error if it cannot. */
+    explicit SharedTraceTable(const std::string& name, std::size_t size = 0)
+        : name_(get_segment_name(name)), data_(nullptr), size_(0) {
+        if (size == 0) {
+            attach_();
+            return;
+        }
+        int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd != -1) {
+            create_(fd, size);
+        } else if (errno == EEXIST) {
+            attach_();
+        } else {
+            throw_error_("unable to create");
+        }
+    }
+
+    SharedTraceTable(const SharedTraceTable&) = delete;
+    SharedTraceTable& operator=(const SharedTraceTable&) = delete;
+
+    ~SharedTraceTable() {
+        if (data_ != nullptr) {
+            munmap(data_, size_);
+        }
+    }
+
+    /* the name of the segment, shm_open wants a leading / */
+    static std::string get_segment_name(const std::string& name) {
+        return name.empty() || name[0] != '/' ? "/" + name : name;
+    }
+
+    /* removes the table called name, processes attached to it keep it until
+       they detach */
+    static void remove(const std::string& name) {
+        if (shm_unlink(get_segment_name(name).c_str()) == -1 &&
+            errno != ENOENT) {
+            throw std::runtime_error("unable to remove shared traces " +
+                                     name + ": " + std::strerror(errno));
+        }
+    }
+
+    // Add count to the trace with hash, rendering its row with render, a
+    // function returning a TraceRecordView, if the table does not have it
+    // yet. Returns false, without adding anything, if the trace is new and
+    // the table is full.
+    template <typename Render>
+    bool insert(std::size_t hash, std::uint64_t count, Render render) {
+        std::uint64_t key = hash == 0 ? 1 : hash;
+        std::uint64_t mask = header_()->slot_count - 1;
+        /* reserved once and kept if the slot is taken by another trace */
+        std::uint64_t row = 0;
+
+        for (std::uint64_t index = key & mask;; index = (index + 1) & mask) {
+            slot_t& slot = slots_()[index];
+            std::uint64_t slot_key = slot.hash.load(std::memory_order_acquire);
+
+            if (slot_key == 0) {
+                if (header_()->full.load(std::memory_order_relaxed)) {
+                    return false;
+                }
+                if (row == 0) {
+                    row = write_row_(render());
+                    if (row == 0) {
+                        return false;
+                    }
+                }
+                if (!slot.hash.compare_exchange_strong(
+                        slot_key, key, std::memory_order_acq_rel)) {
+                    /* someone else took it, slot_key is theirs */
+                    if (slot_key != key) {
+                        continue;
+                    }
+                    /* the row reserved for the same trace is lost */
+                } else {
+                    slot.row.store(row, std::memory_order_release);
+                    if (header_()->used_slot_count.fetch_add(
+                            1, std::memory_order_relaxed) +
+                            1 >=
+                        header_()->slot_count / 4 * 3) {
+                        header_()->full.store(true, std::memory_order_relaxed);
+                    }
+                }
+                slot_key = key;
+            }
+
+            if (slot_key == key) {
+                slot.count.fetch_add(count, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    /* the name of the segment */
+    const std::string& get_name() const {
+        return name_;
+    }
+
+    /* bytes of the segment */
+    std::size_t get_size() const {
+        return size_;
+    }
+
+    /* distinct traces in the table */
+    std::size_t size() const {
+        return header_()->used_slot_count.load(std::memory_order_relaxed);
+    }
+
+    bool is_full() const {
+        return header_()->full.load(std::memory_order_relaxed);
+    }
+
+    /* bytes of the segment in use */
+    std::size_t get_used_size() const {
+        return header_()->arena_offset +
+               std::min(header_()->arena_used.load(std::memory_order_relaxed),
+                        header_()->arena_size);
+    }
+
+    // Write the traces and their counts to filepath in format, sorted by
+    // hash, see TraceRecord.h. The processes tracing into the table should
+    // be done: a trace whose row is not published yet is skipped.
+    void serialize(const std::string& filepath, TracesFormat format) const {
+        std::vector<std::pair<std::uint64_t, const slot_t*>> slots;
+        for (std::uint64_t i = 0; i < header_()->slot_count; ++i) {
+            const slot_t& slot = slots_()[i];
+            if (slot.hash.load(std::memory_order_acquire) != 0 &&
+                slot.row.load(std::memory_order_acquire) != 0) {
+                slots.push_back({slot.hash.load(std::memory_order_relaxed),
+                                 &slot});
+            }
+        }
+        std::sort(slots.begin(), slots.end());
+
+        TraceRecordView row;
+        std::size_t position_count = 0;
+        for (const auto& slot: slots) {
+            read_row_(*slot.second, row);
+            position_count = std::max(
+                position_count,
+                (row.columns.size() - traces_file::FIXED_COLUMN_COUNT) /
+                    traces_file::POSITION_COLUMN_COUNT);
+        }
+
+        TracesFileWriter writer(filepath, format, position_count);
+        for (const auto& slot: slots) {
+            read_row_(*slot.second, row);
+            writer.write(row);
+        }
+        writer.close();
+    }
+
+  private:
+    static const std::uint64_t MAGIC = 0x5352434152544853; /* SHTRACRS */
+    static const std::uint32_t VERSION = 1;
+
+    struct header_t {
+        std::atomic<std::uint64_t> magic;
+        std::uint32_t version;
+        std::uint64_t size;
+        std::uint64_t slot_count;
+        std::uint64_t arena_offset;
+        std::uint64_t arena_size;
+        /* starts at 1, a row at offset 0 would look unpublished */
+        std::atomic<std::uint64_t> arena_used;
+        std::atomic<std::uint64_t> used_slot_count;
+        std::atomic<bool> full;
+    };
+
+    struct slot_t {
+        std::atomic<std::uint64_t> hash;
+        std::atomic<std::uint64_t> count;
+        /* offset of the row in the arena, 0 until it is published */
+        std::atomic<std::uint64_t> row;
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                  "shared traces need lock free atomics");
+
+    const std::string name_;
+    char* data_;
+    std::size_t size_;
+
+    header_t* header_() const {
+        return reinterpret_cast<header_t*>(data_);
+    }
+
+    slot_t* slots_() const {
+        return reinterpret_cast<slot_t*>(data_ + sizeof(header_t));
+    }
+
+    char* arena_() const {
+        return data_ + header_()->arena_offset;
+    }
+
+    [[noreturn]] void throw_error_(const std::string& action) const {
+        throw std::runtime_error(action + " shared traces " + name_ + ": " +
+                                 std::strerror(errno));
+    }
+
+    void map_(int fd, std::size_t size) {
+        void* data =
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw_error_("unable to map");
+        }
+        close(fd);
+        data_ = static_cast<char*>(data);
+        size_ = size;
+    }
+
+    void create_(int fd, std::size_t size) {
+        /* a quarter for the slots, a power of two of them, the rest for the
+           rows */
+        std::uint64_t slot_count = 16;
+        while (2 * slot_count * sizeof(slot_t) <= size / 4) {
+            slot_count *= 2;
+        }
+        std::uint64_t arena_offset =
+            sizeof(header_t) + slot_count * sizeof(slot_t);
+        if (size <= arena_offset) {
+            close(fd);
+            shm_unlink(name_.c_str());
+            throw std::runtime_error("shared traces " + name_ +
+                                     " need more than " +
+                                     std::to_string(size) + " bytes");
+        }
+
+        if (ftruncate(fd, size) == -1) {
+            close(fd);
+            shm_unlink(name_.c_str());
+            throw_error_("unable to size");
+        }
+        map_(fd, size);
+
+        /* the pages of a new segment are zero, the slots are empty */
+        header_t* header = new (data_) header_t();
+        header->version = VERSION;
+        header->size = size;
+        header->slot_count = slot_count;
+        header->arena_offset = arena_offset;
+        header->arena_size = size - arena_offset;
+        header->arena_used.store(1, std::memory_order_relaxed);
+        header->used_slot_count.store(0, std::memory_order_relaxed);
+        header->full.store(false, std::memory_order_relaxed);
+        header->magic.store(MAGIC, std::memory_order_release);
+    }
+
+    void attach_() {
+        int fd = shm_open(name_.c_str(), O_RDWR, 0600);
+        if (fd == -1) {
+            throw_error_("unable to open");
+        }
+
+        /* the creator may not have sized and initialized it yet */
+        const auto TIMEOUT = std::chrono::seconds(10);
+        auto start = std::chrono::steady_clock::now();
+        struct stat file_stat;
+        while (true) {
+            if (fstat(fd, &file_stat) == -1) {
+                close(fd);
+                throw_error_("unable to stat");
+            }
+            if (file_stat.st_size >= static_cast<off_t>(sizeof(header_t))) {
+                break;
+            }
+            if (std::chrono::steady_clock::now() - start > TIMEOUT) {
+                close(fd);
+                throw std::runtime_error("shared traces " + name_ +
+                                         " were never initialized");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        map_(fd, file_stat.st_size);
+
+        while (header_()->magic.load(std::memory_order_acquire) != MAGIC) {
+            if (std::chrono::steady_clock::now() - start > TIMEOUT) {
+                throw std::runtime_error("shared traces " + name_ +
+                                         " were never initialized");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (header_()->version != VERSION || header_()->size != size_) {
+            throw std::runtime_error("shared traces " + name_ +
+                                     " have an unsupported layout");
+        }
+    }
+
+    /* a row is the package and the columns, each a 32 bit length and the
+       bytes, after the number of columns */
+    static std::size_t get_row_size_(const TraceRecordView& row) {
+        std::size_t size = 2 * sizeof(std::uint32_t) +
+                           row.package_under_analysis.size();
+        for (std::string_view column: row.columns) {
+            size += sizeof(std::uint32_t) + column.size();
+        }
+        return size;
+    }
+
+    /* the offset of the row, 0 if the arena is full */
+    std::uint64_t write_row_(const TraceRecordView& row) {
+        std::uint64_t size = get_row_size_(row);
+        std::uint64_t offset =
+            header_()->arena_used.fetch_add(size, std::memory_order_relaxed);
+        if (offset + size > header_()->arena_size) {
+            header_()->full.store(true, std::memory_order_relaxed);
+            return 0;
+        }
+
+        char* current = arena_() + offset;
+        auto write = [&current](const void* data, std::size_t size) {
+            std::memcpy(current, data, size);
+            current += size;
+        };
+        auto write_string = [&write](std::string_view string) {
+            std::uint32_t size = string.size();
+            write(&size, sizeof(size));
+            write(string.data(), string.size());
+        };
+        std::uint32_t column_count = row.columns.size();
+        write(&column_count, sizeof(column_count));
+        write_string(row.package_under_analysis);
+        for (std::string_view column: row.columns) {
+            write_string(column);
+        }
+        return offset;
+    }
+
+    void read_row_(const slot_t& slot, TraceRecordView& row) const {
+        const char* current =
+            arena_() + slot.row.load(std::memory_order_acquire);
+        auto read_uint32 = [&current]() {
+            std::uint32_t value;
+            std::memcpy(&value, current, sizeof(value));
+            current += sizeof(value);
+            return value;
+        };
+        auto read_string = [&]() {
+            std::uint32_t size = read_uint32();
+            std::string_view string(current, size);
+            current += size;
+            return string;
+        };
+
+        row.hash = slot.hash.load(std::memory_order_relaxed);
+        row.count = slot.count.load(std::memory_order_relaxed);
+        std::uint32_t column_count = read_uint32();
+        row.package_under_analysis = read_string();
+        row.columns.clear();
+        for (std::uint32_t i = 0; i < column_count; ++i) {
+            row.columns.push_back(read_string());
+        }
+    }
+};
+
+#endif /* TYPEDYNTRACER_SHARED_TRACE_TABLE_H */
@@ -0,0 +1,253 @@
+#ifndef TYPEDYNTRACER_SPILLING_TRACE_TABLE_H
+#define TYPEDYNTRACER_SPILLING_TRACE_TABLE_H
+
+#include "MappedFile.h"
+#include "TraceRecord.h"
+#include "TraceTable.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A TraceTable kept under a memory limit by spilling it to disk. When the
+// table grows past the limit, its traces are written sorted by hash to a run
+// file in the binary traces format and the table is cleared. When the
+// traces are serialized, the runs and the traces still in memory are merged
+// by hash, reading the runs from their mappings, so a run of any length
+// completes in bounded memory. A trace spilled more than once keeps the
+// columns of its first run and the sum of its counts.
+//
+// A memory limit of 0 never spills. The runs are removed once merged.
+class SpillingTraceTable {
+  public:
+    /* the runs are <run_filepath_prefix>.run<n>.tmp, their directory has to
+       exist. They do not end in .bin, so they are never taken for traces
+       files, such as the shards of forked children. */
+    explicit SpillingTraceTable(std::size_t memory_limit,
+                                const std::string& run_filepath_prefix)
+        : memory_limit_(memory_limit)
+        , run_filepath_prefix_(run_filepath_prefix)
+        , run_position_count_(0)
+        , spilled_trace_count_(0)
+        , spilled_call_count_(0) {
+    }
+
+    SpillingTraceTable(const SpillingTraceTable&) = delete;
+    SpillingTraceTable& operator=(const SpillingTraceTable&) = delete;
+
+    ~SpillingTraceTable() {
+        remove_runs_();
+    }
+
+    void insert(const CallTrace& a_trace) {
+        std::size_t size = table_.size();
+        table_.insert(a_trace);
+        /* only a new trace makes the table grow */
+        if (memory_limit_ != 0 && table_.size() != size &&
+            table_.get_approximate_size() > memory_limit_) {
+            spill_();
+        }
+    }
+
+    /* in bytes, 0 if the table never spills */
+    std::size_t get_memory_limit() const {
+        return memory_limit_;
+    }
+
+    /* the traces that have not been spilled */
+    const TraceTable& get_table() const {
+        return table_;
+    }
+
+    std::size_t get_run_count() const {
+        return run_filepaths_.size();
+    }
+
+    /* whether some traces are not in the table, even once merged, because
+       they were spilled or come from runs that were added */
+    bool has_spilled() const {
+        return spilled_trace_count_ != 0;
+    }
+
+    /* distinct traces, a trace spilled to several runs counts once per run */
+    std::size_t size() const {
+        return spilled_trace_count_ + table_.size();
+    }
+
+    /* calls whose trace was inserted, including repeated ones */
+    std::uint64_t get_traced_call_count() const {
+        return spilled_call_count_ + table_.get_traced_call_count();
+    }
+
+    /* the runs are on disk, only the table counts */
+    std::size_t get_approximate_size() const {
+        return table_.get_approximate_size();
+    }
+
+    // Write the traces and their counts to filepath in format, see
+    // TraceRecord.h, like TraceTable::serialize.
+    void serialize(const std::string& filepath,
+                   const std::string& package_under_analysis,
+                   TracesFormat format = TracesFormat::Normalized) {
+        if (run_filepaths_.empty()) {
+            table_.serialize(filepath, package_under_analysis, format);
+        } else {
+            merge_runs_(filepath, package_under_analysis, format);
+            remove_runs_();
+        }
+    }
+
+    // Take over a traces file in the binary format, sorted by hash, as one
+    // more run: it is merged with the others and removed.
+    void add_run(const std::string& filepath) {
+        MappedFile file(filepath);
+        TraceRecordReader reader(file.begin(), file.end());
+        TraceRecordView row;
+        while (reader.next(row)) {
+            run_position_count_ = std::max(
+                run_position_count_,
+                (row.columns.size() - traces_file::FIXED_COLUMN_COUNT) /
+                    traces_file::POSITION_COLUMN_COUNT);
+            ++spilled_trace_count_;
+            spilled_call_count_ += row.count;
+        }
+        run_filepaths_.push_back(filepath);
+    }
+
+    // Forget the traces and the runs, without removing the runs, and name
+    // the runs after run_filepath_prefix from now on. This is for a forked
+    // child, whose parent owns the runs.
+    void reset(const std::string& run_filepath_prefix) {
+        run_filepath_prefix_ = run_filepath_prefix;
+        table_.clear();
+        run_filepaths_.clear();
+        run_position_count_ = 0;
+        spilled_trace_count_ = 0;
+        spilled_call_count_ = 0;
+    }
+
+  private:
+    const std::size_t memory_limit_;
+    std::string run_filepath_prefix_;
+    TraceTable table_;
+    std::vector<std::string> run_filepaths_;
+    /* the positions of the longest trace of the runs */
+    std::size_t run_position_count_;
+    std::size_t spilled_trace_count_;
+    std::uint64_t spilled_call_count_;
+
+    void spill_() {
+        std::string filepath = run_filepath_prefix_ + ".run" +
+                               std::to_string(run_filepaths_.size()) + ".tmp";
+        /* removed even if writing fails */
+        run_filepaths_.push_back(filepath);
+        /* the package is that of the merged rows */
+        table_.serialize(filepath, "", TracesFormat::Binary);
+
+        run_position_count_ =
+            std::max(run_position_count_, table_.get_position_count());
+        spilled_trace_count_ += table_.size();
+        spilled_call_count_ += table_.get_traced_call_count();
+        table_.clear();
+    }
+
+    struct run_t {
+        std::unique_ptr<MappedFile> file;
+        std::unique_ptr<TraceRecordReader> reader;
+        TraceRecordView row;
+    };
+
+    // The k-way merge of the runs, in the order they were spilled, and of
+    // the table, all sorted by hash. The rows of a hash are written once all
+    // the sources have reached it, before any of them moves on, so the views
+    // of the table's rows are still valid.
+    void merge_runs_(const std::string& filepath,
+                     const std::string& package_under_analysis,
+                     TracesFormat format) const {
+        std::vector<TraceTable::sorted_trace_t> traces =
+            table_.get_sorted_traces();
+        TraceTable::RowRenderer renderer(package_under_analysis);
+        std::size_t next_trace = 0;
+
+        std::vector<run_t> runs(run_filepaths_.size());
+        for (std::size_t i = 0; i < runs.size(); ++i) {
+            runs[i].file = std::make_unique<MappedFile>(run_filepaths_[i]);
+            runs[i].reader = std::make_unique<TraceRecordReader>(
+                runs[i].file->begin(), runs[i].file->end());
+        }
+
+        /* the current row of each source, the table being the last one,
+           nullptr once it has no rows left */
+        std::vector<const TraceRecordView*> rows(runs.size() + 1, nullptr);
+        auto advance = [&](std::size_t source) {
+            if (source < runs.size()) {
+                run_t& run = runs[source];
+                rows[source] = run.reader->next(run.row) ? &run.row : nullptr;
+            } else if (next_trace < traces.size()) {
+                rows[source] = &renderer.render(traces[next_trace++]);
+            } else {
+                rows[source] = nullptr;
+            }
+        };
+
+        /* by hash, then by source */
+        typedef std::pair<std::size_t, std::size_t> entry_t;
+        std::priority_queue<entry_t, std::vector<entry_t>, std::greater<entry_t>>
+            heap;
+        for (std::size_t source = 0; source < rows.size(); ++source) {
+            advance(source);
+            if (rows[source] != nullptr) {
+                heap.push({rows[source]->hash, source});
+            }
+        }
+
+        TracesFileWriter writer(
+            filepath,
+            format,
+            std::max(run_position_count_, table_.get_position_count()));
+        TraceRecordView row;
+        std::vector<std::size_t> sources;
+
+        while (!heap.empty()) {
+            std::size_t hash = heap.top().first;
+            sources.clear();
+            while (!heap.empty() && heap.top().first == hash) {
+                sources.push_back(heap.top().second);
+                heap.pop();
+            }
+
+            /* the columns of the first source, the counts of all */
+            row = *rows[sources.front()];
+            row.package_under_analysis = package_under_analysis;
+            row.count = 0;
+            for (std::size_t source: sources) {
+                row.count += rows[source]->count;
+            }
+            writer.write(row);
+
+            for (std::size_t source: sources) {
+                advance(source);
+                if (rows[source] != nullptr) {
+                    heap.push({rows[source]->hash, source});
+                }
+            }
+        }
+
+        writer.close();
+    }
+
+    void remove_runs_() {
+        for (const std::string& filepath: run_filepaths_) {
+            std::remove(filepath.c_str());
+        }
+        run_filepaths_.clear();
+        run_position_count_ = 0;
+    }
+};
+
+#endif /* TYPEDYNTRACER_SPILLING_TRACE_TABLE_H */
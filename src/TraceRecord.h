@@ -0,0 +1,632 @@
+#ifndef TYPEDYNTRACER_TRACE_RECORD_H
+#define TYPEDYNTRACER_TRACE_RECORD_H
+
+#include "OutputBuffer.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Traces files have one row per distinct trace. In text, a row is
+//
+//   package_being_analyzed,package,fun_name,fun_id,trace_hash,type_hash,
+//   dispatch,has_dots,count,arg_t_r,arg_c_r,arg_a_r,arg_t0,arg_c0,arg_a0,...
+//
+// with a header naming as many arguments as the longest row. This is the
+// wide format. The normalized format, the default, writes the types and the
+// functions once, in two dictionaries next to the traces file, and refers to
+// them by id in the rows:
+//
+//   types_<name>.txt      type_id,type,classes,attrs
+//   functions_<name>.txt  function_id,package,fun_name,fun_id
+//   traces_<name>.txt     package_being_analyzed,trace_hash,function_id,
+//                         type_hash,dispatch,has_dots,count,type_r,type_0,...
+//
+// where a position without a type is NA. Ids are given in the order of first
+// use by the rows, which are sorted by trace hash. The binary format has the
+// rows of the wide format, each column written as it is in text:
+//
+//   magic (8 bytes) | version (32 bits)
+//   then per row: trace_hash (64 bits) | count (64 bits)
+//                 | package_being_analyzed | column count (32 bits)
+//                 | columns...
+//
+// where the columns are those of the text row other than
+// package_being_analyzed, trace_hash and count, and strings are their
+// length (32 bits) followed by their bytes. Integers are in host byte
+// order. Traces are aggregated by trace hash, the other columns are carried
+// along.
+enum class TracesFormat { Normalized, Wide, Binary, COUNT };
+
+/* returns TracesFormat::COUNT if the string does not name a format */
+inline TracesFormat traces_format_from_string(const std::string& str) {
+    if (str == "normalized") {
+        return TracesFormat::Normalized;
+    } else if (str == "wide") {
+        return TracesFormat::Wide;
+    } else if (str == "binary") {
+        return TracesFormat::Binary;
+    }
+    return TracesFormat::COUNT;
+}
+
+namespace traces_file {
+
+const char MAGIC[8] = {'P', 'R', 'O', 'P', 'T', 'R', 'C', 'S'};
+const std::uint32_t VERSION = 1;
+
+/* package, fun_name, fun_id, type_hash, dispatch, has_dots */
+const std::size_t FIXED_COLUMN_COUNT = 6;
+/* type, classes and attributes of each position */
+const std::size_t POSITION_COLUMN_COUNT = 3;
+
+inline std::string get_header(std::size_t position_count) {
+    std::string header =
+        "package_being_analyzed,package,fun_name,fun_id,trace_hash,"
+        "type_hash,dispatch,has_dots,count,arg_t_r,arg_c_r,arg_a_r";
+    for (std::size_t i = 0; i + 1 < position_count; ++i) {
+        header.append(",arg_t" + std::to_string(i) + ",arg_c" +
+                      std::to_string(i) + ",arg_a" + std::to_string(i));
+    }
+    return header;
+}
+
+const std::string NORMALIZED_HEADER_PREFIX =
+    "package_being_analyzed,trace_hash,";
+const std::string TYPES_HEADER = "type_id,type,classes,attrs";
+const std::string FUNCTIONS_HEADER = "function_id,package,fun_name,fun_id";
+/* the type of a position without a type in the normalized format */
+const std::string MISSING_TYPE = "NA";
+/* and its columns in the wide format */
+const char* const MISSING_TYPE_COLUMNS[POSITION_COLUMN_COUNT] = {"???",
+                                                                  "{}",
+                                                                  "{}"};
+
+inline std::string get_normalized_header(std::size_t position_count) {
+    std::string header = NORMALIZED_HEADER_PREFIX +
+                         "function_id,type_hash,dispatch,has_dots,count,type_r";
+    for (std::size_t i = 0; i + 1 < position_count; ++i) {
+        header.append(",type" + std::to_string(i));
+    }
+    return header;
+}
+
+inline bool is_binary(const char* begin, const char* end) {
+    return end - begin >= static_cast<std::ptrdiff_t>(sizeof(MAGIC)) &&
+           std::memcmp(begin, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+inline bool is_normalized(const char* begin, const char* end) {
+    return static_cast<std::size_t>(end - begin) >=
+               NORMALIZED_HEADER_PREFIX.size() &&
+           std::memcmp(begin,
+                       NORMALIZED_HEADER_PREFIX.data(),
+                       NORMALIZED_HEADER_PREFIX.size()) == 0;
+}
+
+/* the dictionary ("types" or "functions") of a normalized traces file, e.g.
+   dir/types_x.txt for dir/traces_x.txt */
+inline std::string get_dictionary_filepath(const std::string& traces_filepath,
+                                           const std::string& dictionary) {
+    const std::string PREFIX = "traces_";
+    std::size_t name = traces_filepath.rfind('/');
+    name = name == std::string::npos ? 0 : name + 1;
+    std::size_t suffix = name;
+    if (traces_filepath.compare(name, PREFIX.size(), PREFIX) == 0) {
+        suffix += PREFIX.size();
+    }
+    return traces_filepath.substr(0, name) + dictionary + "_" +
+           traces_filepath.substr(suffix);
+}
+
+/* the next line from current, which is moved past it */
+inline std::string_view read_line(const char*& current, const char* end) {
+    const char* newline =
+        static_cast<const char*>(std::memchr(current, '\n', end - current));
+    const char* line_end = newline == nullptr ? end : newline;
+    std::string_view line(current, line_end - current);
+    current = newline == nullptr ? end : newline + 1;
+    return line;
+}
+
+/* splits a text row in columns, commas inside quotes do not separate
+   columns */
+inline void split_row(std::string_view line,
+                      std::vector<std::string_view>& fields) {
+    fields.clear();
+    bool quoted = false;
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '"') {
+            quoted = !quoted;
+        } else if (line[i] == ',' && !quoted) {
+            fields.push_back(line.substr(start, i - start));
+            start = i + 1;
+        }
+    }
+    fields.push_back(line.substr(start));
+}
+
+inline std::uint64_t parse_unsigned(std::string_view field) {
+    std::uint64_t value = 0;
+    auto result =
+        std::from_chars(field.data(), field.data() + field.size(), value);
+    if (result.ec != std::errc() || result.ptr != field.data() + field.size()) {
+        throw std::runtime_error("expected a number instead of '" +
+                                 std::string(field) + "'");
+    }
+    return value;
+}
+
+} // namespace traces_file
+
+// Writes a traces file in any format, one row at a time. Row is TraceRecord
+// or TraceRecordView, or anything else with their fields, and rows have to
+// be written sorted by hash. Ids of the normalized format are given as rows
+// are written.
+class TracesFileWriter {
+  public:
+    /* position_count is the largest of the rows, it sizes the header */
+    explicit TracesFileWriter(const std::string& filepath,
+                              TracesFormat format,
+                              std::size_t position_count)
+        : format_(format), traces_(filepath) {
+        /* the header always has the first argument */
+        position_count = std::max<std::size_t>(position_count, 2);
+
+        switch (format_) {
+        case TracesFormat::Normalized:
+            types_ = std::make_unique<OutputBuffer>(
+                traces_file::get_dictionary_filepath(filepath, "types"));
+            functions_ = std::make_unique<OutputBuffer>(
+                traces_file::get_dictionary_filepath(filepath, "functions"));
+            types_->append(traces_file::TYPES_HEADER);
+            types_->append('\n');
+            functions_->append(traces_file::FUNCTIONS_HEADER);
+            functions_->append('\n');
+            traces_.append(traces_file::get_normalized_header(position_count));
+            traces_.append('\n');
+            break;
+        case TracesFormat::Wide:
+            traces_.append(traces_file::get_header(position_count));
+            traces_.append('\n');
+            break;
+        case TracesFormat::Binary:
+            traces_.append(traces_file::MAGIC, sizeof(traces_file::MAGIC));
+            traces_.append_bytes(traces_file::VERSION);
+            break;
+        case TracesFormat::COUNT:
+            throw std::runtime_error("unknown traces format");
+        }
+    }
+
+    template <typename Row>
+    void write(const Row& row) {
+        switch (format_) {
+        case TracesFormat::Normalized:
+            write_normalized_(row);
+            break;
+        case TracesFormat::Wide:
+            write_wide_(row);
+            break;
+        default:
+            write_binary_(row);
+            break;
+        }
+    }
+
+    void close() {
+        traces_.close();
+        if (types_) {
+            types_->close();
+            functions_->close();
+        }
+    }
+
+  private:
+    const TracesFormat format_;
+    OutputBuffer traces_;
+    /* the dictionaries of the normalized format */
+    std::unique_ptr<OutputBuffer> types_;
+    std::unique_ptr<OutputBuffer> functions_;
+    std::unordered_map<std::string, std::size_t> type_ids_;
+    std::unordered_map<std::string, std::size_t> function_ids_;
+    std::string key_;
+
+    template <typename Row>
+    void write_wide_(const Row& row) {
+        traces_.append(row.package_under_analysis);
+        for (std::size_t i = 0; i < row.columns.size(); ++i) {
+            traces_.append(',');
+            traces_.append(row.columns[i]);
+            /* trace_hash goes after fun_id and count after has_dots */
+            if (i == 2) {
+                traces_.append(',');
+                traces_.append_number(row.hash);
+            } else if (i == 5) {
+                traces_.append(',');
+                traces_.append_number(row.count);
+            }
+        }
+        traces_.append('\n');
+    }
+
+    template <typename Row>
+    void write_binary_(const Row& row) {
+        traces_.append_bytes<std::uint64_t>(row.hash);
+        traces_.append_bytes<std::uint64_t>(row.count);
+        write_string_(row.package_under_analysis);
+        traces_.append_bytes<std::uint32_t>(row.columns.size());
+        for (std::string_view column: row.columns) {
+            write_string_(column);
+        }
+    }
+
+    template <typename Row>
+    void write_normalized_(const Row& row) {
+        using traces_file::FIXED_COLUMN_COUNT;
+        using traces_file::POSITION_COLUMN_COUNT;
+
+        /* package, fun_name and fun_id make the function */
+        traces_.append(row.package_under_analysis);
+        traces_.append(',');
+        traces_.append_number(row.hash);
+        traces_.append(',');
+        traces_.append_number(
+            intern_(function_ids_, row.columns, 0, *functions_));
+        for (std::size_t i = 3; i < FIXED_COLUMN_COUNT; ++i) {
+            traces_.append(',');
+            traces_.append(row.columns[i]);
+        }
+        traces_.append(',');
+        traces_.append_number(row.count);
+
+        for (std::size_t begin = FIXED_COLUMN_COUNT; begin < row.columns.size();
+             begin += POSITION_COLUMN_COUNT) {
+            traces_.append(',');
+            if (std::string_view(row.columns[begin]) ==
+                traces_file::MISSING_TYPE_COLUMNS[0]) {
+                traces_.append(traces_file::MISSING_TYPE);
+            } else {
+                traces_.append_number(
+                    intern_(type_ids_, row.columns, begin, *types_));
+            }
+        }
+        traces_.append('\n');
+    }
+
+    /* the id of the 3 columns from begin, which are written to dictionary
+       the first time they are seen */
+    template <typename Columns>
+    std::size_t intern_(std::unordered_map<std::string, std::size_t>& ids,
+                        const Columns& columns,
+                        std::size_t begin,
+                        OutputBuffer& dictionary) {
+        /* rows have no newlines, so this does not mix up columns */
+        key_.clear();
+        for (std::size_t i = begin; i < begin + traces_file::POSITION_COLUMN_COUNT; ++i) {
+            key_.append(std::string_view(columns[i]));
+            key_.push_back('\n');
+        }
+
+        auto iter = ids.find(key_);
+        if (iter != ids.end()) {
+            return iter->second;
+        }
+
+        std::size_t id = ids.size();
+        ids.emplace(key_, id);
+        dictionary.append_number(id);
+        for (std::size_t i = begin; i < begin + traces_file::POSITION_COLUMN_COUNT; ++i) {
+            dictionary.append(',');
+            dictionary.append(columns[i]);
+        }
+        dictionary.append('\n');
+        return id;
+    }
+
+    void write_string_(std::string_view string) {
+        traces_.append_bytes<std::uint32_t>(string.size());
+        traces_.append(string);
+    }
+};
+
+struct TraceRecord {
+    std::string package_under_analysis;
+    std::size_t hash;
+    std::uint64_t count;
+    std::vector<std::string> columns;
+
+    /* positions including the return value */
+    std::size_t get_position_count() const {
+        return (columns.size() - traces_file::FIXED_COLUMN_COUNT) /
+               traces_file::POSITION_COLUMN_COUNT;
+    }
+
+    /* records have to be sorted by hash */
+    static void write_files(const std::string& filepath,
+                            const std::vector<TraceRecord>& records,
+                            TracesFormat format) {
+        std::size_t position_count = 0;
+        for (const TraceRecord& record: records) {
+            position_count =
+                std::max(position_count, record.get_position_count());
+        }
+
+        TracesFileWriter writer(filepath, format, position_count);
+        for (const TraceRecord& record: records) {
+            writer.write(record);
+        }
+        writer.close();
+    }
+};
+
+// A row of a traces file that points into the file's contents instead of
+// owning its columns, so rows whose trace is already known can be counted
+// without copying them.
+struct TraceRecordView {
+    std::string_view package_under_analysis;
+    std::size_t hash;
+    std::uint64_t count;
+    std::vector<std::string_view> columns;
+
+    TraceRecord to_record() const {
+        TraceRecord record;
+        record.package_under_analysis = std::string(package_under_analysis);
+        record.hash = hash;
+        record.count = count;
+        record.columns.reserve(columns.size());
+        for (std::string_view column: columns) {
+            record.columns.emplace_back(column);
+        }
+        return record;
+    }
+};
+
+// The types and functions of a normalized traces file, read from the
+// contents of their files, which have to outlive the dictionary.
+class TraceDictionary {
+  public:
+    typedef std::array<std::string_view, traces_file::POSITION_COLUMN_COUNT>
+        entry_t;
+
+    explicit TraceDictionary(const char* types_begin,
+                             const char* types_end,
+                             const char* functions_begin,
+                             const char* functions_end) {
+        read_(types_begin, types_end, traces_file::TYPES_HEADER, types_);
+        read_(functions_begin,
+              functions_end,
+              traces_file::FUNCTIONS_HEADER,
+              functions_);
+    }
+
+    const entry_t& get_type(std::uint64_t id) const {
+        return get_(types_, id, "type");
+    }
+
+    const entry_t& get_function(std::uint64_t id) const {
+        return get_(functions_, id, "function");
+    }
+
+  private:
+    std::vector<entry_t> types_;
+    std::vector<entry_t> functions_;
+
+    static void read_(const char* current,
+                      const char* end,
+                      const std::string& header,
+                      std::vector<entry_t>& entries) {
+        if (traces_file::read_line(current, end) != header) {
+            throw std::runtime_error("missing header '" + header + "'");
+        }
+
+        std::vector<std::string_view> fields;
+        while (current != end) {
+            std::string_view line = traces_file::read_line(current, end);
+            if (line.empty()) {
+                continue;
+            }
+            traces_file::split_row(line, fields);
+            if (fields.size() != 1 + std::tuple_size<entry_t>::value ||
+                traces_file::parse_unsigned(fields[0]) != entries.size()) {
+                throw std::runtime_error("malformed dictionary row '" +
+                                         std::string(line) + "'");
+            }
+            entries.push_back({fields[1], fields[2], fields[3]});
+        }
+    }
+
+    static const entry_t& get_(const std::vector<entry_t>& entries,
+                               std::uint64_t id,
+                               const char* kind) {
+        if (id >= entries.size()) {
+            throw std::runtime_error(std::string("undefined ") + kind + " " +
+                                     std::to_string(id));
+        }
+        return entries[id];
+    }
+};
+
+// Reads the rows of a traces file, in any format, held in memory. Rows of the
+// normalized format are resolved with dictionary, which is required for
+// them. Throws std::runtime_error if the file is malformed.
+class TraceRecordReader {
+  public:
+    explicit TraceRecordReader(const char* begin,
+                               const char* end,
+                               const TraceDictionary* dictionary = nullptr)
+        : current_(begin)
+        , end_(end)
+        , binary_(traces_file::is_binary(begin, end))
+        , normalized_(traces_file::is_normalized(begin, end))
+        , dictionary_(dictionary) {
+        if (binary_) {
+            current_ += sizeof(traces_file::MAGIC);
+            std::uint32_t version = read_uint32_();
+            if (version != traces_file::VERSION) {
+                throw std::runtime_error("unsupported traces file version " +
+                                         std::to_string(version));
+            }
+        } else {
+            /* skip the header */
+            std::string_view header = traces_file::read_line(current_, end_);
+            if (header.compare(0, 22, "package_being_analyzed") != 0) {
+                throw std::runtime_error("missing traces file header");
+            }
+            if (normalized_ && dictionary_ == nullptr) {
+                throw std::runtime_error(
+                    "normalized traces file without dictionary");
+            }
+        }
+    }
+
+    /* reads the next row, returns false at the end of the file */
+    bool next(TraceRecordView& view) {
+        if (binary_) {
+            if (current_ == end_) {
+                return false;
+            }
+            next_binary_(view);
+            return true;
+        }
+
+        while (current_ != end_) {
+            std::string_view line = traces_file::read_line(current_, end_);
+            if (line.empty()) {
+                continue;
+            }
+            traces_file::split_row(line, fields_);
+            if (normalized_) {
+                next_normalized_(line, view);
+            } else {
+                next_wide_(line, view);
+            }
+            return true;
+        }
+        return false;
+    }
+
+  private:
+    const char* current_;
+    const char* const end_;
+    const bool binary_;
+    const bool normalized_;
+    const TraceDictionary* const dictionary_;
+    std::vector<std::string_view> fields_;
+
+    void next_binary_(TraceRecordView& view) {
+        view.hash = read_uint64_();
+        view.count = read_uint64_();
+        view.package_under_analysis = read_string_();
+        std::uint32_t column_count = read_uint32_();
+        check_column_count_(column_count);
+        view.columns.clear();
+        for (std::uint32_t i = 0; i < column_count; ++i) {
+            view.columns.push_back(read_string_());
+        }
+    }
+
+    void next_wide_(std::string_view line, TraceRecordView& view) {
+        if (fields_.size() < 3) {
+            throw std::runtime_error("malformed traces file row '" +
+                                     std::string(line) + "'");
+        }
+        check_column_count_(fields_.size() - 3);
+
+        view.package_under_analysis = fields_[0];
+        view.hash = traces_file::parse_unsigned(fields_[4]);
+        view.count = traces_file::parse_unsigned(fields_[8]);
+        view.columns.clear();
+        for (std::size_t i = 1; i < fields_.size(); ++i) {
+            if (i != 4 && i != 8) {
+                view.columns.push_back(fields_[i]);
+            }
+        }
+    }
+
+    /* package_being_analyzed, trace_hash, function_id, type_hash, dispatch,
+       has_dots, count, then a type per position */
+    void next_normalized_(std::string_view line, TraceRecordView& view) {
+        if (fields_.size() < 8) {
+            throw std::runtime_error("malformed traces file row '" +
+                                     std::string(line) + "'");
+        }
+
+        view.package_under_analysis = fields_[0];
+        view.hash = traces_file::parse_unsigned(fields_[1]);
+        view.count = traces_file::parse_unsigned(fields_[6]);
+        view.columns.clear();
+        for (std::string_view column: dictionary_->get_function(
+                 traces_file::parse_unsigned(fields_[2]))) {
+            view.columns.push_back(column);
+        }
+        for (std::size_t i = 3; i < 6; ++i) {
+            view.columns.push_back(fields_[i]);
+        }
+        for (std::size_t i = 7; i < fields_.size(); ++i) {
+            if (fields_[i] == traces_file::MISSING_TYPE) {
+                for (const char* column: traces_file::MISSING_TYPE_COLUMNS) {
+                    view.columns.push_back(column);
+                }
+            } else {
+                for (std::string_view column: dictionary_->get_type(
+                         traces_file::parse_unsigned(fields_[i]))) {
+                    view.columns.push_back(column);
+                }
+            }
+        }
+    }
+
+    void check_column_count_(std::size_t column_count) const {
+        if (column_count < traces_file::FIXED_COLUMN_COUNT +
+                               traces_file::POSITION_COLUMN_COUNT ||
+            (column_count - traces_file::FIXED_COLUMN_COUNT) %
+                    traces_file::POSITION_COLUMN_COUNT !=
+                0) {
+            throw std::runtime_error("malformed traces file row with " +
+                                     std::to_string(column_count) +
+                                     " columns");
+        }
+    }
+
+    void read_(void* value, std::size_t size) {
+        if (static_cast<std::size_t>(end_ - current_) < size) {
+            throw std::runtime_error("truncated traces file");
+        }
+        std::memcpy(value, current_, size);
+        current_ += size;
+    }
+
+    std::uint32_t read_uint32_() {
+        std::uint32_t value;
+        read_(&value, sizeof(value));
+        return value;
+    }
+
+    std::uint64_t read_uint64_() {
+        std::uint64_t value;
+        read_(&value, sizeof(value));
+        return value;
+    }
+
+    std::string_view read_string_() {
+        std::uint32_t size = read_uint32_();
+        if (static_cast<std::size_t>(end_ - current_) < size) {
+            throw std::runtime_error("truncated traces file");
+        }
+        std::string_view string(current_, size);
+        current_ += size;
+        return string;
+    }
+};
+
+#endif /* TYPEDYNTRACER_TRACE_RECORD_H */
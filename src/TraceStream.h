@@ -0,0 +1,371 @@
+#ifndef TYPEDYNTRACER_TRACE_STREAM_H
+#define TYPEDYNTRACER_TRACE_STREAM_H
+
+#include "TraceRecord.h"
+#include "footprint.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Traces streamed to the aggregator (tools/aggregator) over a Unix domain
+// socket. A stream starts with
+//
+//   magic (8 bytes) | version (32 bits) | package_being_analyzed
+//
+// followed by records, each starting with its kind (8 bits):
+//
+//   trace: trace_hash (64 bits) | count (64 bits) | column count (32 bits)
+//          | columns...
+//   count: trace_hash (64 bits) | count (64 bits)
+//
+// A trace record carries the columns of a trace the first time the process
+// sees it, as in the binary traces format, and count records add to the
+// count of a trace already sent. Strings are their length (32 bits)
+// followed by their bytes and integers are in host byte order.
+namespace trace_stream {
+
+const char MAGIC[8] = {'P', 'R', 'O', 'P', 'S', 'T', 'R', 'M'};
+const std::uint32_t VERSION = 1;
+
+enum class RecordKind : std::uint8_t { Trace = 1, Count = 2 };
+
+} // namespace trace_stream
+
+// The tracer's end of a trace stream. Records are batched in a buffer that
+// is sent without blocking when it is large enough, so a slow aggregator
+// only delays the process once the buffer reaches its limit. The counts of
+// the traces already sent are kept as deltas, by hash, and sent every few
+// thousand calls. The rows of the traces sent are kept encoded, as in their
+// records, not as traces.
+//
+// If the aggregator goes away, insert returns false and the caller has to
+// keep the traces itself from then on, starting with those the aggregator
+// did not get, see write_unsent. Throws std::runtime_error if it cannot
+// connect.
+class TraceStreamClient {
+  public:
+    explicit TraceStreamClient(const std::string& socket_path,
+                               const std::string& package_under_analysis)
+        : socket_path_(socket_path)
+        , package_under_analysis_(package_under_analysis)
+        , fd_(-1)
+        , buffer_offset_(0)
+        , insert_count_(0) {
+        connect_();
+    }
+
+    TraceStreamClient(const TraceStreamClient&) = delete;
+    TraceStreamClient& operator=(const TraceStreamClient&) = delete;
+
+    ~TraceStreamClient() {
+        try {
+            close();
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+    bool is_connected() const {
+        return fd_ != -1;
+    }
+
+    const std::string& get_socket_path() const {
+        return socket_path_;
+    }
+
+    /* traces sent, not counting the calls */
+    std::size_t size() const {
+        return deltas_.size();
+    }
+
+    std::size_t get_approximate_size() const {
+        return get_hash_table_overhead(deltas_) +
+               deltas_.size() * sizeof(trace_t) + rows_.capacity() +
+               pending_records_.size() * sizeof(record_t);
+    }
+
+    // Count a call with the trace with hash, rendering its row with render,
+    // a function returning a TraceRecordView, if it was not sent yet.
+    // Returns false, without counting the call, if the stream is closed. A
+    // call counted as the aggregator goes away is in write_unsent.
+    template <typename Render>
+    bool insert(std::size_t hash, Render render) {
+        if (!is_connected()) {
+            return false;
+        }
+
+        auto inserted = deltas_.insert({hash, {rows_.size(), 0}});
+        if (inserted.second) {
+            write_trace_(render());
+        } else if (inserted.first->second.delta++ == 0) {
+            dirty_hashes_.push_back(hash);
+        }
+
+        if (++insert_count_ % COUNT_INTERVAL == 0) {
+            write_counts_();
+        }
+        if (buffer_.size() >= BATCH_SIZE) {
+            send_(buffer_.size() >= MAX_BUFFER_SIZE);
+        }
+        return true;
+    }
+
+    /* sends everything, blocking until it is sent */
+    void flush() {
+        if (is_connected()) {
+            write_counts_();
+            send_(true);
+        }
+    }
+
+    void close() {
+        flush();
+        disconnect_();
+    }
+
+    // Connect again, forgetting what was not sent. This is for a forked
+    // child, the parent has to flush before forking. The aggregator knows
+    // the traces sent by the parent, so the child only sends counts for
+    // them.
+    void reconnect() {
+        disconnect_();
+        pending_records_.clear();
+        dirty_hashes_.clear();
+        for (auto& delta: deltas_) {
+            delta.second.delta = 0;
+        }
+        connect_();
+    }
+
+    // Once the aggregator is gone, write the traces and counts it did not
+    // get to filepath, as a binary traces file sorted by hash, each trace
+    // with the calls not sent, and forget them. The caller can then merge
+    // the file into its own traces, see SpillingTraceTable::add_run. Returns
+    // false, writing nothing, if the aggregator got everything.
+    bool write_unsent(const std::string& filepath) {
+        if (is_connected()) {
+            return false;
+        }
+
+        std::unordered_map<std::size_t, std::uint64_t> unsent_counts;
+        for (const record_t& record: pending_records_) {
+            unsent_counts[record.hash] += record.count;
+        }
+        for (std::size_t hash: dirty_hashes_) {
+            unsent_counts[hash] += deltas_.at(hash).delta;
+        }
+        pending_records_.clear();
+        dirty_hashes_.clear();
+        if (unsent_counts.empty()) {
+            return false;
+        }
+
+        std::vector<TraceRecordView> rows(unsent_counts.size());
+        std::size_t position_count = 0;
+        std::size_t index = 0;
+        for (const auto& unsent: unsent_counts) {
+            TraceRecordView& row = rows[index++];
+            read_row_(deltas_.at(unsent.first).row, row);
+            row.count = unsent.second;
+            position_count = std::max(
+                position_count,
+                (row.columns.size() - traces_file::FIXED_COLUMN_COUNT) /
+                    traces_file::POSITION_COLUMN_COUNT);
+        }
+        std::sort(rows.begin(),
+                  rows.end(),
+                  [](const TraceRecordView& a, const TraceRecordView& b) {
+                      return a.hash < b.hash;
+                  });
+
+        TracesFileWriter writer(filepath, TracesFormat::Binary, position_count);
+        for (const TraceRecordView& row: rows) {
+            writer.write(row);
+        }
+        writer.close();
+        return true;
+    }
+
+  private:
+    /* bytes buffered before trying to send them */
+    static const std::size_t BATCH_SIZE = 1 << 16;
+    /* bytes buffered before waiting for the aggregator */
+    static const std::size_t MAX_BUFFER_SIZE = 1 << 24;
+    /* calls between two sends of the counts */
+    static const std::uint64_t COUNT_INTERVAL = 4096;
+
+    struct trace_t {
+        /* offset of the row of the trace in rows_ */
+        std::size_t row;
+        /* the calls since its count was last written */
+        std::uint64_t delta;
+    };
+
+    /* a record written to the buffer, until it is sent in full */
+    struct record_t {
+        /* offset in the stream of the end of the record */
+        std::uint64_t end;
+        std::size_t hash;
+        std::uint64_t count;
+    };
+
+    const std::string socket_path_;
+    const std::string package_under_analysis_;
+    int fd_;
+    std::string buffer_;
+    /* offset in the stream of the start of buffer_ */
+    std::uint64_t buffer_offset_;
+    std::deque<record_t> pending_records_;
+    std::unordered_map<std::size_t, trace_t> deltas_;
+    std::vector<std::size_t> dirty_hashes_;
+    /* the rows of the traces sent, encoded as in their trace records */
+    std::string rows_;
+    std::uint64_t insert_count_;
+
+    void connect_() {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (socket_path_.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("socket path too long: " + socket_path_);
+        }
+        std::memcpy(address.sun_path, socket_path_.data(), socket_path_.size());
+
+        fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ == -1 ||
+            connect(fd_, reinterpret_cast<sockaddr*>(&address),
+                    sizeof(address)) == -1) {
+            std::string error = std::strerror(errno);
+            disconnect_();
+            throw std::runtime_error("unable to connect to " + socket_path_ +
+                                     ": " + error);
+        }
+
+        buffer_.append(trace_stream::MAGIC, sizeof(trace_stream::MAGIC));
+        append_(trace_stream::VERSION);
+        append_string_(package_under_analysis_);
+    }
+
+    /* the records not sent in full are kept in pending_records_ */
+    void disconnect_() {
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        buffer_offset_ = 0;
+        buffer_.clear();
+    }
+
+    template <typename T>
+    static void append_(std::string& buffer, T value) {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void append_string_(std::string& buffer, std::string_view string) {
+        append_<std::uint32_t>(buffer, string.size());
+        buffer.append(string.data(), string.size());
+    }
+
+    template <typename T>
+    void append_(T value) {
+        append_(buffer_, value);
+    }
+
+    void append_string_(std::string_view string) {
+        append_string_(buffer_, string);
+    }
+
+    /* the end of the record just written to the buffer */
+    void end_record_(std::size_t hash, std::uint64_t count) {
+        pending_records_.push_back(
+            {buffer_offset_ + buffer_.size(), hash, count});
+    }
+
+    void write_trace_(const TraceRecordView& row) {
+        std::size_t row_begin = rows_.size();
+        append_<std::uint64_t>(rows_, row.hash);
+        append_<std::uint64_t>(rows_, row.count);
+        append_<std::uint32_t>(rows_, row.columns.size());
+        for (std::string_view column: row.columns) {
+            append_string_(rows_, column);
+        }
+
+        append_(trace_stream::RecordKind::Trace);
+        buffer_.append(rows_, row_begin, std::string::npos);
+        end_record_(row.hash, row.count);
+    }
+
+    /* the row written by write_trace_ at offset, pointing into rows_ */
+    void read_row_(std::size_t offset, TraceRecordView& row) const {
+        auto read = [&](auto& value) {
+            std::memcpy(&value, rows_.data() + offset, sizeof(value));
+            offset += sizeof(value);
+        };
+        std::uint64_t hash;
+        std::uint64_t count;
+        std::uint32_t column_count;
+        read(hash);
+        read(count);
+        read(column_count);
+        row.package_under_analysis = package_under_analysis_;
+        row.hash = hash;
+        row.columns.clear();
+        for (std::uint32_t i = 0; i < column_count; ++i) {
+            std::uint32_t size;
+            read(size);
+            row.columns.emplace_back(rows_.data() + offset, size);
+            offset += size;
+        }
+    }
+
+    void write_counts_() {
+        for (std::size_t hash: dirty_hashes_) {
+            std::uint64_t& delta = deltas_.at(hash).delta;
+            append_(trace_stream::RecordKind::Count);
+            append_<std::uint64_t>(hash);
+            append_<std::uint64_t>(delta);
+            end_record_(hash, delta);
+            delta = 0;
+        }
+        dirty_hashes_.clear();
+    }
+
+    /* sends what it can without blocking, or everything */
+    void send_(bool wait) {
+        std::size_t sent = 0;
+        while (sent < buffer_.size()) {
+            ssize_t count = send(fd_, buffer_.data() + sent,
+                                 buffer_.size() - sent,
+                                 MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT));
+            if (count >= 0) {
+                sent += count;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else {
+                /* the aggregator is gone */
+                disconnect_();
+                return;
+            }
+        }
+        buffer_.erase(0, sent);
+        buffer_offset_ += sent;
+        while (!pending_records_.empty() &&
+               pending_records_.front().end <= buffer_offset_) {
+            pending_records_.pop_front();
+        }
+    }
+};
+
+#endif /* TYPEDYNTRACER_TRACE_STREAM_H */
@@ -0,0 +1,321 @@
+#ifndef TYPEDYNTRACER_TRACE_TABLE_H
+#define TYPEDYNTRACER_TRACE_TABLE_H
+
+#include "CallTrace.h"
+#include "TraceRecord.h"
+#include "TypeTable.h"
+#include "footprint.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The distinct call traces seen so far and how many times each was seen.
+// Like CallTrace, this does not depend on R, so traces can be aggregated and
+// written out by the tracer as well as by tools reading them back.
+class TraceTable {
+  public:
+    explicit TraceTable(): traced_call_count_(0), trace_bytes_(0) {
+    }
+
+    // Inserted traces with no order of their own, the first one inserted
+    // is kept.
+    static const std::uint64_t NO_ORDER =
+        std::numeric_limits<std::uint64_t>::max();
+
+    // Either we've seen the call trace before, in which case we want to count
+    // that and discard the trace, or we haven't and we need to save it.
+    // count is the number of calls the trace stands for. Traces with the
+    // same hash are the same trace, and the one kept is the one with the
+    // smallest order, so the traces kept do not depend on the order tables
+    // are filled and merged in when the traces are given an order.
+    void insert(const CallTrace& a_trace,
+                int count = 1,
+                std::uint64_t order = NO_ORDER) {
+        traced_call_count_ += count;
+        auto iter = counts_.find(a_trace);
+        if (iter != counts_.end()) {
+            // its in
+            iter->second.count += count;
+            if (order < iter->second.order) {
+                iter->second.order = order;
+                CallTrace& kept = traces_.at(a_trace);
+                trace_bytes_ += a_trace.get_approximate_size();
+                trace_bytes_ -= kept.get_approximate_size();
+                kept = a_trace;
+            }
+        } else {
+            // its not in yet
+            traces_.insert(std::make_pair(a_trace, a_trace));
+            counts_.insert(std::make_pair(a_trace, entry_t{count, order}));
+            // once as key and value of traces_ and once as key of counts_
+            trace_bytes_ += 3 * a_trace.get_approximate_size();
+        }
+    }
+
+    // Add the traces of other for which keep is true, with their counts and
+    // orders.
+    template <typename F>
+    void merge(const TraceTable& other, F keep) {
+        for (const auto& element: other.counts_) {
+            if (keep(element.first)) {
+                insert(other.traces_.at(element.first),
+                       element.second.count,
+                       element.second.order);
+            }
+        }
+    }
+
+    void merge(const TraceTable& other) {
+        merge(other, [](const CallTrace&) { return true; });
+    }
+
+    std::size_t size() const {
+        return traces_.size();
+    }
+
+    /* removes all the traces and releases their memory */
+    void clear() {
+        std::unordered_map<CallTrace, CallTrace, CallTraceHasher>().swap(
+            traces_);
+        std::unordered_map<CallTrace, entry_t, CallTraceHasher>().swap(
+            counts_);
+        traced_call_count_ = 0;
+        trace_bytes_ = 0;
+    }
+
+    /* calls whose trace was inserted, including repeated ones */
+    std::uint64_t get_traced_call_count() const {
+        return traced_call_count_;
+    }
+
+    std::size_t get_approximate_size() const {
+        return get_hash_table_overhead(traces_) +
+               get_hash_table_overhead(counts_) +
+               counts_.size() * sizeof(entry_t) + trace_bytes_;
+    }
+
+    struct sorted_trace_t {
+        std::size_t hash;
+        const CallTrace* trace;
+        int count;
+    };
+
+    // The traces and their counts sorted by hash, which is the order they
+    // are written in.
+    std::vector<sorted_trace_t> get_sorted_traces() const {
+        return get_sorted_traces({this});
+    }
+
+    // The traces of tables, which must not have traces in common, sorted by
+    // hash.
+    static std::vector<sorted_trace_t>
+    get_sorted_traces(const std::vector<const TraceTable*>& tables) {
+        std::vector<sorted_trace_t> traces;
+        for (const TraceTable* table: tables) {
+            traces.reserve(traces.size() + table->counts_.size());
+            for (const auto& element: table->counts_) {
+                traces.push_back({element.first.compute_hash(),
+                                  &table->traces_.at(element.first),
+                                  element.second.count});
+            }
+        }
+        std::sort(traces.begin(),
+                  traces.end(),
+                  [](const sorted_trace_t& a, const sorted_trace_t& b) {
+                      return a.hash < b.hash;
+                  });
+        return traces;
+    }
+
+    // The positions of the longest trace, including the return value. This
+    // is the number of positions in the header of a traces file.
+    std::size_t get_position_count() const {
+        std::size_t position_count = 0;
+        for (const auto& element: traces_) {
+            position_count = std::max<std::size_t>(
+                position_count, get_last_position(element.second) + 2);
+        }
+        return position_count;
+    }
+
+    // Renders sorted traces as rows of a traces file: the columns of a type
+    // are rendered once per distinct type and the others into buffers
+    // reused from row to row, so rendering a trace allocates nothing. A row
+    // is valid until the next one is rendered, and package_under_analysis
+    // has to outlive the renderer.
+    class RowRenderer {
+      public:
+        explicit RowRenderer(std::string_view package_under_analysis) {
+            row_.package_under_analysis = package_under_analysis;
+        }
+
+        const TraceRecordView& render(const sorted_trace_t& trace) {
+            const CallTrace& el = *trace.trace;
+            row_.hash = trace.hash;
+            row_.count = trace.count;
+            row_.columns.clear();
+
+            // The preamble.
+            fn_id_column_.assign("\"").append(el.get_fn_id()).append("\"");
+            char* type_hash_end =
+                std::to_chars(type_hash_column_,
+                              type_hash_column_ + sizeof(type_hash_column_),
+                              el.compute_hash_just_for_types())
+                    .ptr;
+            row_.columns.push_back(el.get_package_name());
+            row_.columns.push_back(el.get_function_name());
+            row_.columns.push_back(fn_id_column_);
+            row_.columns.push_back(std::string_view(
+                type_hash_column_, type_hash_end - type_hash_column_));
+            row_.columns.push_back(get_dispatch_name(el.get_dispatch_type()));
+            row_.columns.push_back(el.get_has_dots() ? "1" : "0");
+
+            // The positions up to the last argument, starting with the
+            // return value at -1.
+            const std::unordered_map<int, Type>& trace_map =
+                el.get_call_trace();
+            int max_ = get_last_position(el);
+
+            for (int i = -1; i <= max_; ++i) {
+                auto iter = trace_map.find(i);
+                if (iter == trace_map.end()) {
+                    // put nothing
+                    for (const char* column:
+                         traces_file::MISSING_TYPE_COLUMNS) {
+                        row_.columns.push_back(column);
+                    }
+                    continue;
+                }
+
+                type_id_t id = types_.intern(iter->second);
+                if (static_cast<std::size_t>(id) == type_columns_.size()) {
+                    type_columns_.push_back(serialize_type(iter->second));
+                }
+                for (const std::string& column: type_columns_[id]) {
+                    row_.columns.push_back(column);
+                }
+            }
+
+            return row_;
+        }
+
+      private:
+        /* a deque does not move its elements, the views stay valid */
+        TypeTable types_;
+        std::deque<std::array<std::string, traces_file::POSITION_COLUMN_COUNT>>
+            type_columns_;
+        std::string fn_id_column_;
+        char type_hash_column_[std::numeric_limits<std::size_t>::digits10 + 1];
+        TraceRecordView row_;
+    };
+
+    // Write the traces and their counts to filepath, one trace per line, in
+    // format, see TraceRecord.h.
+    void serialize(const std::string& filepath,
+                   const std::string& package_under_analysis,
+                   TracesFormat format = TracesFormat::Normalized) const {
+        serialize({this}, filepath, package_under_analysis, format);
+    }
+
+    // Write the traces of tables, which must not have traces in common, as
+    // if they were one table. The traces are sorted by hash so the output
+    // does not depend on how they were inserted or split between tables.
+    static void serialize(const std::vector<const TraceTable*>& tables,
+                          const std::string& filepath,
+                          const std::string& package_under_analysis,
+                          TracesFormat format = TracesFormat::Normalized) {
+        std::vector<sorted_trace_t> traces = get_sorted_traces(tables);
+
+        std::size_t position_count = 0;
+        for (const TraceTable* table: tables) {
+            position_count =
+                std::max(position_count, table->get_position_count());
+        }
+
+        TracesFileWriter writer(filepath, format, position_count);
+        RowRenderer renderer(package_under_analysis);
+        for (const sorted_trace_t& trace: traces) {
+            writer.write(renderer.render(trace));
+        }
+        writer.close();
+    }
+
+    // makes the columns "type", "{classes}", "{attrs}"
+    static std::array<std::string, traces_file::POSITION_COLUMN_COUNT>
+    serialize_type(const Type& type) {
+        return {"\"" + get_type_name(type) + "\"",
+                "\"" + get_name_list(type.get_classes()) + "\"",
+                "\"" + get_name_list(type.get_attr_names()) + "\""};
+    }
+
+    // the type with its tags, type@tag@...
+    static std::string get_type_name(const Type& type) {
+        std::string name = type.get_top_level_type();
+        for (const std::string& tag: *type.get_tags()) {
+            name += "@" + tag;
+        }
+        return name;
+    }
+
+    // classes or attribute names as {name-...}
+    static std::string get_name_list(const std::vector<std::string>& names) {
+        return "{" + join_(names) + "}";
+    }
+
+    static const char* get_dispatch_name(int dispatch) {
+        switch (dispatch) {
+        case 1: /* DYNTRACE_DISPATCH_S3 */
+            return "S3";
+        case 2: /* DYNTRACE_DISPATCH_S4 */
+            return "S4";
+        }
+        return "None";
+    }
+
+    // the position of the last argument of the trace, -1 if it only has the
+    // return value
+    static int get_last_position(const CallTrace& trace) {
+        const std::unordered_map<int, Type>& trace_map = trace.get_call_trace();
+        int max_ = trace_map.begin()->first;
+        for (const auto& kv: trace_map) {
+            max_ = std::max(max_, kv.first);
+        }
+        return max_;
+    }
+
+  private:
+    // traces_ should have a list of traces, we can look for hash collisions
+    // and call it an already seen trace
+    std::unordered_map<CallTrace, CallTrace, CallTraceHasher> traces_;
+    // ^ is to see if we have already seen the calltrace (in a way that doesnt suck)
+    struct entry_t {
+        int count;
+        /* the smallest order the trace was inserted with */
+        std::uint64_t order;
+    };
+    std::unordered_map<CallTrace, entry_t, CallTraceHasher> counts_;
+    std::uint64_t traced_call_count_;
+    /* bytes of the stored traces, see CallTrace::get_approximate_size */
+    std::size_t trace_bytes_;
+
+    static std::string join_(const std::vector<std::string>& strings) {
+        std::string joined;
+        for (std::size_t i = 0; i < strings.size(); ++i) {
+            if (i != 0) {
+                joined += "-";
+            }
+            joined += strings[i];
+        }
+        return joined;
+    }
+};
+
+#endif /* TYPEDYNTRACER_TRACE_TABLE_H */
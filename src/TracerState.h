@@ -7,18 +7,34 @@
 #include "DenotedValue.h"
 #include "DependencyNodeGraph.h"
 #include "Event.h"
+#include "EventLog.h"
 #include "ExecutionContextStack.h"
 #include "Function.h"
+#include "MemoryMonitor.h"
+#include "ProbeProfiler.h"
 #include "sexptypes.h"
 #include "stdlibs.h"
+#include "timing.h"
 #include "CallTrace.h"
-
+#include "SharedTraceTable.h"
+#include "TraceStream.h"
+#include "SpillingTraceTable.h"
+#include "TypeCache.h"
+#include "TypeTable.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <sstream> // for serializing
 #include <string>  // for serializing
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <unordered_map>
 
@@ -29,8 +45,29 @@ class TracerState {
 public:
   const std::string &get_output_dirpath() const { return output_dirpath_; }
 
-  execution_contexts_t unwind_stack(const RCNTXT *context) {
-    return get_stack_().unwind(ExecutionContext(context));
+  // Unwinding to the R context of a jump is done in place: begin_unwind
+  // accounts for the contexts above it as exited and returns the size of
+  // the stack once they are gone. They stay on the stack, from that index
+  // to the top, until end_unwind truncates it, which can be done one
+  // context at a time as they are processed from the top down.
+  std::size_t begin_unwind(const RCNTXT *context) {
+    ExecutionContextStack &stack = get_stack_();
+    std::size_t size = stack.find_unwind_size(ExecutionContext(context));
+    /* contexts are unwound innermost first, so each one exits into the
+       next, and the last one into the context left on top. */
+    for (std::size_t index = stack.size(); index > size; --index) {
+      exit_context_(stack[index - 1], &stack[index - 2]);
+    }
+    return size;
+  }
+
+  void end_unwind(std::size_t size) { get_stack_().truncate(size); }
+
+  std::size_t get_stack_size() const { return stack_.size(); }
+
+  /* from the bottom of the stack, unchecked */
+  ExecutionContext &get_stack_context(std::size_t index) {
+    return get_stack_()[index];
   }
 
   void remove_promise(const SEXP promise, DenotedValue *promise_state) {
@@ -44,36 +81,201 @@ public:
 
   bool is_binary() const { return binary_; }
 
+  TracesFormat get_traces_format() const {
+    if (is_binary()) {
+      return TracesFormat::Binary;
+    }
+    return wide_traces_ ? TracesFormat::Wide : TracesFormat::Normalized;
+  }
+
   int get_compression_level() const { return compression_level_; }
 
-  void exit_probe(const Event event) { resume_execution_timer(); }
+  void exit_probe(const Event event) {
+    resume_execution_timer();
+    if (profile_probes_) {
+      probe_profiler_.end_probe(event);
+    }
+  }
 
   void enter_probe(const Event event) {
+    if (profile_probes_) {
+      probe_profiler_.begin_probe();
+    }
     pause_execution_timer();
     increment_timestamp_();
     ++event_counter_[to_underlying(event)];
+    if (memory_monitor_.is_sampling_due(timestamp_)) {
+      sample_memory_usage_();
+    }
   }
 
   void enter_gc() { ++gc_cycle_; }
 
+  // Type of a value, reusing the type computed the last time the same
+  // object was seen if it cannot have changed since. gc_unmark invalidates
+  // the cached type of collected objects, see TypeCache.
+  Type get_value_type(const SEXP value) {
+    if (!TypeCache::is_cacheable(value)) {
+      /* an unshared object can be modified in place, so the type cached
+         while it was shared may be stale by the time it is shared again */
+      type_cache_.invalidate(value);
+      return Type(value);
+    }
+    type_id_t type_id = type_cache_.lookup(value);
+    if (type_id == UNASSIGNED_TYPE_ID) {
+      type_id = type_table_.intern(Type(value));
+      type_cache_.insert(value, type_id);
+    }
+    return type_table_.get_type(type_id);
+  }
+
+  void invalidate_value_type(const SEXP value) {
+    type_cache_.invalidate(value);
+  }
+
   void pause_execution_timer() {
-    auto execution_pause_time = std::chrono::high_resolution_clock::now();
+#if EXECUTION_TIMING
     std::uint64_t execution_time =
-        std::chrono::duration_cast<std::chrono::nanoseconds>(
-            execution_pause_time - execution_resume_time_)
-            .count();
+        read_cycle_counter() - execution_resume_time_;
     ExecutionContextStack &stack(get_stack_());
     if (!stack.is_empty()) {
-      stack.peek(1).increment_execution_time(execution_time);
+      stack.top().increment_execution_time(execution_time);
     }
+#endif
   }
 
   void resume_execution_timer() {
-    execution_resume_time_ = std::chrono::high_resolution_clock::now();
+#if EXECUTION_TIMING
+    execution_resume_time_ = read_cycle_counter();
+#endif
+  }
+
+  void initialize() {
+    /* a session is initialized by its first segment */
+    if (!initialized_) {
+      /* the trace table spills to it */
+      create_output_directory_();
+      serialize_configuration_();
+      initialized_ = true;
+    }
+    if (record_events_) {
+      create_event_log_(get_output_dirpath() + "/events_" +
+                        get_segment_name_() + ".bin");
+    }
+  }
+
+  // A session traces several expressions with the same tracer, so that the
+  // functions and types it knows stay known from one expression to the
+  // next. Only what is known by content stays known: R can collect objects
+  // between expressions without the tracer seeing it and reuse their
+  // addresses, so what is known by address, the functions by closure, the
+  // cached types, the promises and the values of the dependencies, is
+  // forgotten when an expression ends. Each expression is a segment with its own analyzed file name,
+  // under which its traces, or its events, are written when it ends. The
+  // statistics of the functions and probes and the dependencies cover the
+  // whole session and are written when it ends, under the analyzed file
+  // name of the tracer.
+
+  // Call this before tracing each expression of a session.
+  void begin_segment(const std::string &analyzed_file_name) {
+    in_session_ = true;
+    segment_name_ = analyzed_file_name;
+    trace_table_.reset(output_dirpath_ + "/traces_" + segment_name_);
+  }
+
+  // Call this instead of serialize_and_output and cleanup when an expression
+  // of a session is done.
+  void end_segment(int error) {
+    session_error_ = session_error_ || error;
+    serialize_segment_();
+    forget_objects_();
+  }
+
+  // Call this when the session is done, the tracer is not used afterwards.
+  void end_session() {
+    if (memory_monitor_.get_sampling_interval() != 0) {
+      sample_memory_usage_();
+    }
+    serialize_statistics_();
+    cleanup(session_error_);
+  }
+
+  bool is_in_session() const {
+    return in_session_;
+  }
+
+  // Forked children, e.g. of mclapply, only report what they trace
+  // themselves: a child starts with no traces and writes the ones it sees
+  // to traces_<name>.shard<pid>.bin before it sends its result to its
+  // parent, in binary, and the parent merges the shards of all its children
+  // into its own traces. With record_events, a child writes its calls to
+  // events_<name>.shard<pid>.bin instead. A shard is written under a .tmp
+  // name and renamed when complete, so the parent never reads a shard the
+  // child is still writing, or was killed while writing. The other output
+  // files are only written by the parent.
+
+  // Call this in the parent before forking.
+  void prepare_fork() {
+    /* the child must not write the parent's buffered events again */
+    if (event_log_) {
+      event_log_->flush();
+    }
+    /* nor send the parent's buffered traces again, or hand them back */
+    if (trace_stream_) {
+      trace_stream_->flush();
+      adopt_unsent_traces_();
+    }
+  }
+
+  // Call this in the child after forking.
+  void enter_fork_child() {
+    shard_name_ = (is_fork_child() ? shard_name_ : get_segment_name_()) +
+                  ".shard" + std::to_string(getpid());
+    shard_written_ = false;
+    memory_monitor_.stop();
+    if (event_log_) {
+      create_event_log_(get_shard_filepath_("events") + ".tmp");
+    } else {
+      trace_table_.reset(output_dirpath_ + "/traces_" + shard_name_);
+    }
+    if (trace_stream_ && trace_stream_->is_connected()) {
+      try {
+        trace_stream_->reconnect();
+      } catch (const std::runtime_error&) {
+        /* the child keeps its traces in its shard */
+        trace_stream_.reset();
+      }
+    }
   }
 
-  void initialize() const { 
-    serialize_configuration_();
+  // Call this in the child before it reports to its parent, or when it
+  // exits. This can be called more than once, the shard is only written the
+  // first time.
+  void exit_fork_child() {
+    if (!is_fork_child() || shard_written_) {
+      return;
+    }
+    shard_written_ = true;
+    if (trace_stream_) {
+      trace_stream_->close();
+      adopt_unsent_traces_();
+    }
+    const std::string filepath =
+        get_shard_filepath_(event_log_ ? "events" : "traces");
+    if (event_log_) {
+      event_log_->close();
+    } else {
+      trace_table_.serialize(filepath + ".tmp", package_under_analysis_,
+                             TracesFormat::Binary);
+    }
+    if (std::rename((filepath + ".tmp").c_str(), filepath.c_str()) != 0) {
+      throw std::runtime_error("unable to rename " + filepath + ".tmp: " +
+                               std::strerror(errno));
+    }
+  }
+
+  bool is_fork_child() const {
+    return !shard_name_.empty();
   }
 
   std::unordered_map<SEXP, DenotedValue *> promises_;
@@ -82,10 +284,51 @@ public:
   ExecutionContextStack &get_stack_() { return stack_; }
 
   TracerState(const std::string &output_dirpath, const std::string &package_under_analysis, const std::string &analyzed_file_name, 
-              bool verbose, bool truncate, bool binary, int compression_level)
+              bool verbose, bool truncate, bool binary, int compression_level,
+              const std::unordered_map<std::string, TypingMode> &primitive_typing_modes,
+              TypingMode default_primitive_typing_mode,
+              bool profile_probes, std::size_t memory_sampling_interval,
+              bool record_events, bool wide_traces, bool track_dependencies,
+              std::size_t trace_memory_limit,
+              const std::string &shared_traces_name,
+              std::size_t shared_traces_size,
+              const std::string &trace_socket)
       : output_dirpath_(output_dirpath), package_under_analysis_(package_under_analysis), analyzed_file_name_(analyzed_file_name), 
-        verbose_(verbose), truncate_(truncate), binary_(binary), compression_level_(compression_level), timestamp_(0),
-        event_counter_(to_underlying(Event::COUNT), 0) {  }
+        gc_cycle_(0), verbose_(verbose), truncate_(truncate), binary_(binary), compression_level_(compression_level),
+        execution_resume_time_(0), event_counter_(to_underlying(Event::COUNT), 0), timestamp_(0),
+        call_depth_(0),
+        trace_table_(trace_memory_limit,
+                     output_dirpath + "/traces_" + analyzed_file_name),
+        row_renderer_(package_under_analysis_),
+        type_cache_(TYPE_CACHE_SIZE),
+        primitive_typing_modes_(DEFAULT_PRIMITIVE_TYPING_MODES),
+        default_primitive_typing_mode_(default_primitive_typing_mode),
+        profile_probes_(profile_probes),
+        memory_monitor_(memory_sampling_interval), function_bytes_(0),
+        call_trace_bytes_(0), record_events_(record_events),
+        wide_traces_(wide_traces), shard_written_(false),
+        track_dependencies_(track_dependencies), in_session_(false),
+        initialized_(false), session_error_(false) {
+    for (const auto &binding : primitive_typing_modes) {
+      primitive_typing_modes_.insert_or_assign(binding.first, binding.second);
+    }
+    if (!shared_traces_name.empty()) {
+      shared_traces_ = std::make_unique<SharedTraceTable>(shared_traces_name,
+                                                          shared_traces_size);
+    }
+    if (!trace_socket.empty()) {
+      trace_stream_ = std::make_unique<TraceStreamClient>(
+          trace_socket, package_under_analysis_);
+    }
+  }
+
+  TypingMode get_primitive_typing_mode(const std::string &name) const {
+    auto iter = primitive_typing_modes_.find(name);
+    if (iter != primitive_typing_modes_.end()) {
+      return iter->second;
+    }
+    return default_primitive_typing_mode_;
+  }
 
   Function *lookup_function(const SEXP op) {
     Function *function = nullptr;
@@ -99,7 +342,13 @@ public:
     if (iter2 == function_cache_.end()) {
       function =
           new Function(op, package_name, function_definition, function_id);
+      if (!function->is_closure()) {
+        /* for primitives the id is the name of the c function */
+        function->set_typing_mode(get_primitive_typing_mode(function_id));
+      }
       function_cache_.insert({function_id, function});
+      function_bytes_ +=
+          function->get_approximate_size() + get_heap_size(function_id);
     } else {
       function = iter2->second;
     }
@@ -142,7 +391,7 @@ public:
     DenotedValue *promise_state =
         new DenotedValue(get_next_denoted_value_id_(), promise, local);
 
-    promise_state->set_creation_scope(infer_creation_scope());
+    promise_state->set_creation_scope(&infer_creation_scope());
 
     /* Setting this bit tells us that the promise is currently in the
        promises table. As long as this is set, the call holding a reference
@@ -151,27 +400,30 @@ public:
     return promise_state;
   }
 
-  scope_t infer_creation_scope() {
+  // The id of the nearest function on the stack that is a meaningful
+  // scope, which the stack tracks as calls are pushed, see push_stack. The
+  // id lives as long as the tracer.
+  const scope_t &infer_creation_scope() {
     ExecutionContextStack &stack = get_stack_();
-
-    for (auto iter = stack.crbegin(); iter != stack.crend(); ++iter) {
-      if (iter->is_call()) {
-        const Function *const function = iter->get_call()->get_function();
-        /* '{' function as promise creation source is not very
-           insightful. We want to keep going back until we find
-           something meaningful. */
-        if (!function->is_curly_bracket()) {
-          return function->get_id();
-        }
-      }
+    std::size_t index = stack.get_scope_index();
+    if (index == ExecutionContextStack::NO_SCOPE) {
+      return TOP_LEVEL_SCOPE;
     }
-    return TOP_LEVEL_SCOPE;
+    return stack[index].get_call()->get_function()->get_id();
   }
 
   template <typename T> void push_stack(T *context) {
     get_stack_().push(context);
   }
 
+  void push_stack(Call *call) {
+    Function *function = call->get_function();
+    function->enter_call(++call_depth_);
+    /* '{' function as promise creation source is not very insightful, the
+       scope is that of the nearest call of something meaningful. */
+    get_stack_().push(call, !function->is_curly_bracket());
+  }
+
   void cleanup(int error) {
         
         for (auto const& binding: promises_) {
@@ -238,6 +490,7 @@ public:
                                   dyntrace_dispatch_t dispatch) {
 
       CallTrace * ct = new CallTrace(pname, fname, fn_id, dispatch, num_traces++);
+      call_trace_bytes_ += ct->get_approximate_size();
       return ct;
     }
 
@@ -307,23 +560,22 @@ public:
     ExecutionContext pop_stack() {
         ExecutionContextStack& stack(get_stack_());
         ExecutionContext exec_ctxt(stack.pop());
-        if (!stack.is_empty()) {
-            stack.peek(1).increment_execution_time(
-                exec_ctxt.get_execution_time());
-        }
+        exit_context_(exec_ctxt, stack.is_empty() ? nullptr : &stack.top());
         return exec_ctxt;
     }
 
     // propagatr logic is in DependencyNodeGraph
 
-    // Get the dependency node graph.
-    // NOTE: Currently we do nothing with this, so the dependencies are never output.
-    // We would like to use this, though, and it would improve the analysis results if we could
-    // make use of this data. Consider.
+    // Get the dependency node graph. It is only fed and written out when
+    // tracking dependencies.
     DependencyNodeGraph& get_dependencies() {
         return dependencies_;
     }
 
+    bool is_tracking_dependencies() const {
+        return track_dependencies_;
+    }
+
     /*
     *
             typer stuff!!
@@ -333,191 +585,155 @@ public:
     // Send a call trace to the tracer for processing.
     // Either we've seen the call trace before, in which case we want to count that and discard the trace,
     // or we haven't and we need to save it.
-    void deal_with_call_trace(CallTrace a_trace) {
-        if (traces_.count(a_trace) == 1) {
-            // its in
-            counts_.insert_or_assign(a_trace, counts_.at(a_trace) + 1);
-        } else {
-            // its not in yet
-            traces_.insert(std::make_pair(a_trace, a_trace));
-            counts_.insert(std::pair<CallTrace, int>(a_trace, 1));
+    // When recording events the trace is only logged, the analysis is left
+    // to the replay tool. primitive is true for builtins and specials.
+    void deal_with_call_trace(CallTrace a_trace, bool primitive = false) {
+        if (event_log_) {
+            event_log_->write_call(a_trace, primitive);
+        } else if (shared_traces_) {
+            if (!insert_shared_trace_(a_trace)) {
+                trace_table_.insert(a_trace);
+            }
+        } else if (!trace_stream_ || !stream_trace_(a_trace)) {
+            trace_table_.insert(a_trace);
         }
     }
 
-    // makes the string "type, {classes}, {attrs}"
-    // std::string serialize_for_param_pos(std::unordered_map<int, Type> * trace_map, int pos) {
-    std::string serialize_for_param_pos(Type type) {
-      std::stringstream out;
-
-      // type
-      out << "\"" << type.get_top_level_type();
+    // Serialize and output the list of traces that we've seen, with those
+    // of the forked children. When streaming, the traces are only written if
+    // some could not be sent.
+    void serialize_traces_list() {
+      // this always runs before writing dependencies
+      create_output_directory_();
 
-      // tags
-      std::vector<std::string> * tags = type.get_tags();
-      if (tags->size() != 0) {
-        for (auto it = tags->begin(); it != tags->end(); ++it) {
-          out << "@" << * it;
-        }
+      if (!is_fork_child()) {
+        adopt_fork_shards_();
       }
-      
-      out << "\",\"{";
-
-      // classes
-      std::vector<std::string> classes = type.get_classes();
-      int size_as_int = classes.size();
-      for (int i = 0; i < size_as_int; ++i) {
-        
-        out << classes[i];
 
-        if (i != size_as_int - 1) {
-          out << "-";
-        } 
+      if (trace_stream_) {
+        trace_stream_->flush();
+        adopt_unsent_traces_();
+        if (trace_table_.size() == 0 && !trace_table_.has_spilled()) {
+          return;
+        }
       }
 
-      out << "}\",\"{";
-
-      // attrs
-      std::vector<std::string> attrs = type.get_attr_names();
-      size_as_int = attrs.size();
-      for (int i = 0; i < size_as_int; ++i) {
-        out << attrs[i];
+      // see TraceRecord.h for the formats
+      trace_table_.serialize(get_output_dirpath() + "/traces_" +
+                                 get_segment_name_() +
+                                 (is_binary() ? ".bin" : ".txt"),
+                             package_under_analysis_,
+                             get_traces_format());
+    }
 
-        if (i != size_as_int - 1) {
-          out << "-";
-        } 
-      }
+    // Write out all the dependencies: the nodes with their component, and
+    // the direct edges between nodes with how many values went through them.
+    // The fun_ids map to packages and names in function_statistics_<name>.txt.
+    void serialize_dependencies() {
+      dependencies_.serialize(output_dirpath_ + "/dependencies_" +
+                              analyzed_file_name_ + ".bin");
+    }
 
-      out << "}\"";
+    /* statistics that are cheap enough to be polled while tracing */
 
-      return out.str();
+    /* whether the traces are counted in a shared table, see
+       SharedTraceTable.h */
+    bool is_sharing_traces() const {
+      return shared_traces_ != nullptr;
     }
 
-    // Serialize and output the list of traces that we've seen.
-    void serialize_traces_list() {
-
-      // 1. init stringstream
-      std::stringstream out;
+    /* whether the traces are sent to an aggregator, see TraceStream.h */
+    bool is_streaming_traces() const {
+      return trace_stream_ != nullptr;
+    }
 
-      // make directories - this always runs before writing dependencies
-      struct stat info;
-      if (stat(output_dirpath_.c_str(), &info) != 0) {
-        // DNE, create
-        mkdir_p(output_dirpath_.c_str(), S_IRWXU);
-      } else {
-        // exists, nothing to do
-      }
+    const SpillingTraceTable& get_trace_table() const {
+      return trace_table_;
+    }
 
-      std::ofstream out_file(get_output_dirpath() + "/traces_" + analyzed_file_name_ + ".txt");
+    const std::string& get_package_under_analysis() const {
+      return package_under_analysis_;
+    }
 
-      // We need this to store the max number of args to generate a good .csv header.
-      int max_of_max = 0;
+    std::size_t get_distinct_trace_count() const {
+      return trace_table_.size();
+    }
 
-      // 2. iterate through keys \in traces_
-      //    print the trace + counts to file
-      for (std::pair<CallTrace, CallTrace> element : traces_) {
-        CallTrace el = element.second;
+    /* calls whose trace was recorded, including repeated ones */
+    std::uint64_t get_traced_call_count() const {
+      return trace_table_.get_traced_call_count();
+    }
 
-        std::string dispatch_type = "None";
-        switch(el.get_dispatch_type()) {
-          case DYNTRACE_DISPATCH_S3:
-            dispatch_type = "S3";
-            break;
-          case DYNTRACE_DISPATCH_S4:
-            dispatch_type = "S4";
-            break;
-        }
+    const std::vector<unsigned long int>& get_event_counts() const {
+      return event_counter_;
+    }
 
-        // Write the preamble.
-        std::unordered_map<int, Type> trace_map = el.get_call_trace();
-        out << package_under_analysis_ << "," << el.get_package_name() << "," << el.get_function_name() << ",\"" << el.get_fn_id() << "\"," << el.compute_hash() << "," << el.compute_hash_just_for_types() << "," << dispatch_type << "," << el.get_has_dots() << "," << counts_[el] << ",";
+    std::size_t get_live_promise_count() const {
+      return promises_.size();
+    }
 
-        std::vector<int> keys;
-        keys.reserve(trace_map.size());
-        for (auto kv : trace_map) {
-          keys.push_back(kv.first);
-        }
+    std::size_t get_function_count() const {
+      return function_cache_.size();
+    }
 
-        // We need to get the trace with the maximum number of args, so that we can generate
-        // the correct .csv header.
-        int max_ = keys[0];
-        for (int v : keys) {
-          if (max_ < v) 
-            max_ = v;
-        }
+    timestamp_t get_timestamp() const {
+      return timestamp_;
+    }
 
-        max_of_max = fmax(max_, max_of_max);
-
-        // Serialize the traces.
-        for (int i = -1; i <= max_; ++i) {
-          if (std::find(keys.begin(), keys.end(), i) != keys.end()) {
-            // found
-            Type type_to_serialize = trace_map.at(i);
-            out << serialize_for_param_pos(type_to_serialize);
-          } else {
-            // put nothing
-            out << "???,{},{}";
-          }
-
-          if (i != max_) {
-              out << ",";
-            } else {
-              out << "\n";
-            }
-        }
+    gc_cycle_t get_gc_cycle() const {
+      return gc_cycle_;
+    }
 
-        // get all (ret is first @ -1)
-        /*
-        int size_as_int = trace_map.size();
-        for (int i = -1; i < (size_as_int - 1); ++i) {
-          // TODO pass this by reference?
-          std::cout << "i: " << i << "\n";
-
-          Type type_to_serialize = trace_map.at(i);
-          out << serialize_for_param_pos(type_to_serialize);
-
-          if (i != size_as_int - 2) {
-            out << ", ";
-          } else {
-            out << "\n";
-          }
-        }
-        */
-
-        // write to file and empty
-        // TODO TODO TODO do we want to do this??
-        // or write incrementally...
-        // will these files ever get so big
-        // out_file << out.rdbuf();
-        // out.clear();
+    // Live objects and approximate bytes held by each of the data
+    // structures of the tracer. Functions are counted with the size they had
+    // when first seen, heap allocated call traces with the size they had
+    // when created, before their arguments were added.
+    std::vector<memory_usage_t> get_memory_usage() const {
+      std::vector<memory_usage_t> usages{
+          {"promises", promises_.size(),
+           get_hash_table_overhead(promises_) +
+               promises_.size() * (sizeof(std::pair<const SEXP, DenotedValue*>) +
+                                   sizeof(DenotedValue))},
+          {"functions", functions_.size(),
+           get_hash_table_overhead(functions_) +
+               functions_.size() * sizeof(std::pair<const SEXP, Function*>)},
+          {"function_cache", function_cache_.size(),
+           get_hash_table_overhead(function_cache_) +
+               function_cache_.size() *
+                   sizeof(std::pair<const function_id_t, Function*>) +
+               function_bytes_},
+          {"traces", trace_table_.size(), trace_table_.get_approximate_size()},
+          {"call_traces", static_cast<std::size_t>(num_traces),
+           call_trace_bytes_},
+          {"dependencies",
+           dependencies_.get_value_count() + dependencies_.get_node_count(),
+           dependencies_.get_approximate_size()},
+          {"type_table", type_table_.size(),
+           type_table_.get_approximate_size()},
+          {"type_cache", type_cache_.size(),
+           type_cache_.get_approximate_size()},
+          /* with the scope index of each frame */
+          {"stack", stack_.size(),
+           stack_.size() * (sizeof(ExecutionContext) + sizeof(std::size_t))}};
+
+      /* of all the processes using it */
+      if (shared_traces_) {
+        usages.push_back({"shared_traces", shared_traces_->size(),
+                          shared_traces_->get_used_size()});
       }
-    
-      // Generate header, write it, then write all the traces out.
-      int max_num_of_args = max_of_max;
-      std::string init_header_string = "package_being_analyzed,package,fun_name,fun_id,trace_hash,type_hash,dispatch,has_dots,count,arg_t_r,arg_c_r,arg_a_r";
-      for (int i = 0; i <= max_num_of_args; ++i) {
-        std::string elt = ",arg_t" + std::to_string(i) + ",arg_c" + std::to_string(i) + ",arg_a" + std::to_string(i);
-        init_header_string.append(elt);
+      /* the encoded rows of the traces sent */
+      if (trace_stream_) {
+        usages.push_back({"trace_stream", trace_stream_->size(),
+                          trace_stream_->get_approximate_size()});
       }
 
-      // close file when finished
-      out_file << init_header_string << "\n";
-      out_file << out.rdbuf();
-      out_file.close();
-    }
-
-    // Write out all the dependencies.
-    // TODO: better comments once we work on this more.
-    void serialize_dependencies() {
-      std::stringstream out;
-
-      // first, print the graph in the following form:
-      out << dependencies_.serialize().rdbuf();
-
-      std::ofstream out_file_2(output_dirpath_ + "/dependency_graph_" + analyzed_file_name_ + ".txt");
-      out_file_2 << out.rdbuf();
-      out_file_2.close();
-
-      // then, print the fun_ids mapping to function names and packages
+      memory_usage_t total{"total", 0, 0};
+      for (const memory_usage_t& usage: usages) {
+        total.objects += usage.objects;
+        total.bytes += usage.bytes;
+      }
+      usages.push_back(total);
+      return usages;
     }
 
     // Call this when you are done tracing.
@@ -525,11 +741,13 @@ public:
       
       std::cout << "begin: serialize traces...\n\n";
 
-      serialize_traces_list();
+      if (memory_monitor_.get_sampling_interval() != 0) {
+        sample_memory_usage_();
+      }
 
-      // std::cout << "begin: serialize dependencies...\n\n";
+      serialize_segment_();
 
-      // serialize_dependencies();
+      serialize_statistics_();
 
       std::cout << "end: serialize...\n\n";
     }
@@ -544,21 +762,226 @@ public:
     const bool truncate_;
     const bool binary_;
     const int compression_level_;
-    std::chrono::time_point<std::chrono::high_resolution_clock>
-        execution_resume_time_;
+    /* in cycle counter ticks */
+    std::uint64_t execution_resume_time_;
     std::vector<unsigned long int> event_counter_;
     timestamp_t timestamp_;
     call_id_t call_id_counter_;
+    /* number of calls on the stack */
+    int call_depth_;
 
     // this is for propagatr specifically
     DependencyNodeGraph dependencies_;
 
     // this is for typr
-    // traces_ should have a list of traces, we can look for hash collisions
-    // and call it an already seen trace
-    std::unordered_map<CallTrace, CallTrace, CallTraceHasher> traces_;
-    // ^ is to see if we have already seen the calltrace (in a way that doesnt suck)
-    std::unordered_map<CallTrace, int, CallTraceHasher> counts_;
+    SpillingTraceTable trace_table_;
+
+    // the traces are counted in a table shared with other processes if
+    // there is one, trace_table_ only keeps those it has no room for. See
+    // SharedTraceTable.h.
+    std::unique_ptr<SharedTraceTable> shared_traces_;
+
+    // otherwise they are sent to an aggregator if there is one, until it
+    // goes away. See TraceStream.h.
+    std::unique_ptr<TraceStreamClient> trace_stream_;
+
+    // renders the rows of the shared and streamed traces
+    TraceTable::RowRenderer row_renderer_;
+
+    // types of values that have already been seen, see get_value_type
+    TypeTable type_table_;
+    TypeCache type_cache_;
+
+    // how much of the arguments of builtins and specials to type
+    std::unordered_map<std::string, TypingMode> primitive_typing_modes_;
+    const TypingMode default_primitive_typing_mode_;
+
+    // time spent in each probe, see ProbeProfiler
+    const bool profile_probes_;
+    ProbeProfiler probe_profiler_;
+
+    // see get_memory_usage. These are the bytes of the stored objects that
+    // cannot be derived from the sizes of the containers holding them.
+    MemoryMonitor memory_monitor_;
+    std::size_t function_bytes_;
+    std::size_t call_trace_bytes_;
+
+    // calls are written to the event log instead of the trace table, see
+    // EventLog.h
+    const bool record_events_;
+    std::unique_ptr<EventLogWriter> event_log_;
+
+    // the traces are normalized unless this is set, see TraceRecord.h
+    const bool wide_traces_;
+
+    // in a forked child, the name of its output files instead of
+    // get_segment_name_(), see enter_fork_child
+    std::string shard_name_;
+    bool shard_written_;
+
+    // arguments and return values are fed to dependencies_, see
+    // DependencyNodeGraph.h
+    const bool track_dependencies_;
+
+    // in a session, the analyzed file name of the expression being traced
+    // instead of analyzed_file_name_, see begin_segment
+    bool in_session_;
+    std::string segment_name_;
+    bool initialized_;
+    bool session_error_;
+
+    const std::string& get_segment_name_() const {
+      return is_in_session() ? segment_name_ : analyzed_file_name_;
+    }
+
+    void serialize_segment_() {
+      /* the traces are written by the replay tool */
+      if (event_log_) {
+        event_log_->close();
+      } else {
+        serialize_traces_list();
+      }
+    }
+
+    void serialize_statistics_() {
+      serialize_probe_statistics_();
+
+      serialize_functions_();
+
+      if (track_dependencies_) {
+        serialize_dependencies();
+      }
+    }
+
+    bool insert_shared_trace_(const CallTrace& a_trace) {
+      std::size_t hash = a_trace.compute_hash();
+      return shared_traces_->insert(hash, 1, [&]() -> const TraceRecordView& {
+        return row_renderer_.render({hash, &a_trace, 1});
+      });
+    }
+
+    bool stream_trace_(const CallTrace& a_trace) {
+      std::size_t hash = a_trace.compute_hash();
+      if (trace_stream_->insert(hash, [&]() -> const TraceRecordView& {
+            return row_renderer_.render({hash, &a_trace, 1});
+          })) {
+        return true;
+      }
+      adopt_unsent_traces_();
+      return false;
+    }
+
+    // Once the aggregator is gone, take back the traces and counts it did
+    // not get, as a run of the trace table.
+    void adopt_unsent_traces_() {
+      const std::string filepath =
+          output_dirpath_ + "/traces_" +
+          (is_fork_child() ? shard_name_ : get_segment_name_()) +
+          ".unsent.tmp";
+      if (trace_stream_->write_unsent(filepath)) {
+        trace_table_.add_run(filepath);
+      }
+    }
+
+    // Forget everything known by the address of an R object, see
+    // begin_segment. The functions stay in function_cache_, by id.
+    void forget_objects_() {
+      for (auto const& binding: promises_) {
+        destroy_promise(binding.second);
+      }
+      promises_.clear();
+      functions_.clear();
+      type_cache_.clear();
+      dependencies_.remove_values();
+    }
+
+    void create_event_log_(const std::string& filepath) {
+      event_log_ = std::make_unique<EventLogWriter>(
+          filepath, package_under_analysis_, [](sexptype_t sexptype) {
+            /* the pseudo sexptypes are not known to R */
+            return sexptype < UNBOUNDSXP ? std::string(type2char(sexptype))
+                                         : sexptype_to_string(sexptype);
+          });
+    }
+
+    /* the file the shard of kind, traces or events, is renamed to once
+       complete */
+    std::string get_shard_filepath_(const std::string& kind) const {
+      return output_dirpath_ + "/" + kind + "_" + shard_name_ + ".bin";
+    }
+
+    // Hand the trace shards of the forked children, and of their own
+    // children, to the trace table to be merged. The shards still being
+    // written end in .tmp and are left out, and a shard that cannot be read
+    // is reported and left out, instead of losing the traces of the parent.
+    void adopt_fork_shards_() {
+      const std::string prefix = "traces_" + get_segment_name_() + ".shard";
+      const std::string suffix = ".bin";
+
+      DIR* directory = opendir(output_dirpath_.c_str());
+      if (directory == nullptr) {
+        return;
+      }
+      std::vector<std::string> filenames;
+      while (const dirent* entry = readdir(directory)) {
+        std::string filename = entry->d_name;
+        if (filename.size() > prefix.size() + suffix.size() &&
+            filename.compare(0, prefix.size(), prefix) == 0 &&
+            filename.compare(filename.size() - suffix.size(), suffix.size(),
+                             suffix) == 0) {
+          filenames.push_back(filename);
+        }
+      }
+      closedir(directory);
+
+      /* the order of the runs decides which columns a trace keeps */
+      std::sort(filenames.begin(), filenames.end());
+      for (const std::string& filename: filenames) {
+        try {
+          trace_table_.add_run(output_dirpath_ + "/" + filename);
+        } catch (const std::runtime_error& e) {
+          std::cerr << "ignoring the traces of " << filename << ": "
+                    << e.what() << std::endl;
+        }
+      }
+    }
+
+    void create_output_directory_() const {
+        struct stat info;
+        if (stat(output_dirpath_.c_str(), &info) != 0) {
+            // DNE, create
+            mkdir_p(output_dirpath_.c_str(), S_IRWXU);
+        }
+    }
+
+    void sample_memory_usage_() {
+        memory_monitor_.sample(get_output_dirpath() + "/MEMORY_USAGE",
+                               timestamp_,
+                               gc_cycle_,
+                               get_memory_usage());
+    }
+
+    // Account for a context that has just been removed from the stack.
+    // parent is the context it exits into, if any.
+    void exit_context_(const ExecutionContext& exec_ctxt,
+                       ExecutionContext* parent) {
+#if EXECUTION_TIMING
+        if (parent != nullptr) {
+            parent->increment_execution_time(exec_ctxt.get_execution_time());
+            /* promises and R contexts are transparent, the time spent in
+               them outside of calls is the parent's own time */
+            parent->increment_callee_execution_time(
+                exec_ctxt.is_call() ? exec_ctxt.get_execution_time()
+                                    : exec_ctxt.get_callee_execution_time());
+        }
+#endif
+        if (exec_ctxt.is_call()) {
+            --call_depth_;
+            exec_ctxt.get_call()->get_function()->exit_call(
+                exec_ctxt.get_execution_time(),
+                exec_ctxt.get_exclusive_execution_time());
+        }
+    }
 
     call_id_t get_next_call_id_() {
         return ++call_id_counter_;
@@ -587,6 +1010,76 @@ public:
         serialize_row("binary", std::to_string(is_binary()));
         serialize_row("compression_level",
                       std::to_string(get_compression_level()));
+        serialize_row("default_primitive_typing_mode",
+                      to_string(default_primitive_typing_mode_));
+        for (const auto& binding: primitive_typing_modes_) {
+            serialize_row("primitive_typing_mode[" + binding.first + "]",
+                          to_string(binding.second));
+        }
+        serialize_row("profile_probes", std::to_string(profile_probes_));
+        serialize_row("memory_sampling_interval",
+                      std::to_string(memory_monitor_.get_sampling_interval()));
+        serialize_row("record_events", std::to_string(record_events_));
+        serialize_row("wide_traces", std::to_string(wide_traces_));
+        serialize_row("track_dependencies", std::to_string(track_dependencies_));
+        serialize_row("trace_memory_limit",
+                      std::to_string(trace_table_.get_memory_limit()));
+        serialize_row("shared_traces",
+                      shared_traces_ ? shared_traces_->get_name() : "");
+        serialize_row("shared_traces_size",
+                      std::to_string(shared_traces_ ? shared_traces_->get_size()
+                                                    : 0));
+        serialize_row("trace_socket",
+                      trace_stream_ ? trace_stream_->get_socket_path() : "");
+        serialize_row("cycle_counter", get_cycle_counter_name());
+        serialize_row("execution_timing", std::to_string(EXECUTION_TIMING));
+    }
+
+    // Write out what we know about every function seen while tracing.
+    // Inclusive time includes callees, exclusive time does not. Times are in
+    // nanoseconds and NA if execution timing is compiled out.
+    void serialize_functions_() const {
+        std::ofstream fout(get_output_dirpath() + "/function_statistics_" +
+                               analyzed_file_name_ + ".txt",
+                           std::ios::trunc);
+
+        fout << "package,fun_id,names,call_count,inclusive_time,"
+                "exclusive_time,max_depth"
+             << std::endl;
+
+        for (const auto& binding: function_cache_) {
+            const Function* function = binding.second;
+
+            fout << function->get_namespace() << ",\"" << function->get_id()
+                 << "\",\"{";
+
+            const std::vector<std::string>& names = function->get_names();
+            for (std::size_t i = 0; i < names.size(); ++i) {
+                fout << names[i];
+                if (i != names.size() - 1) {
+                    fout << "-";
+                }
+            }
+
+            fout << "}\"," << function->get_call_count() << ",";
+
+#if EXECUTION_TIMING
+            fout << ticks_to_nanoseconds(
+                        function->get_inclusive_execution_time())
+                 << ","
+                 << ticks_to_nanoseconds(
+                        function->get_exclusive_execution_time());
+#else
+            fout << "NA,NA";
+#endif
+            fout << "," << function->get_max_call_depth() << std::endl;
+        }
+    }
+
+    void serialize_probe_statistics_() const {
+        probe_profiler_.serialize(get_output_dirpath() + "/PROBE_STATS",
+                                  event_counter_,
+                                  profile_probes_);
     }
 
     denoted_value_id_t get_next_denoted_value_id_() {
@@ -613,7 +1106,7 @@ public:
         } else {
             value =
                 new DenotedValue(get_next_denoted_value_id_(), argument, false);
-            value->set_creation_scope(infer_creation_scope());
+            value->set_creation_scope(&infer_creation_scope());
         }
         bool default_argument = true;
         if (value->is_promise()) {
@@ -630,6 +1123,22 @@ public:
         call->add_argument(arg);
     }
 
+    // The binding of the first formal in the frame of rho, R_NilValue if
+    // there is none. A closure's environment is created with its arguments
+    // bound in the order of the formals, though dispatch can bind its
+    // variables in front of them, and a hashed environment has no frame.
+    static SEXP find_first_argument_binding_(const SEXP rho, const SEXP op) {
+        SEXP formals = FORMALS(op);
+        if (formals == R_NilValue || HASHTAB(rho) != R_NilValue) {
+            return R_NilValue;
+        }
+        SEXP binding = FRAME(rho);
+        while (binding != R_NilValue && TAG(binding) != TAG(formals)) {
+            binding = CDR(binding);
+        }
+        return binding;
+    }
+
     void process_closure_arguments_(Call* call, const SEXP op) {
         SEXP formal = nullptr;
         SEXP name = nullptr;
@@ -637,12 +1146,20 @@ public:
         SEXP rho = call->get_environment();
         int formal_parameter_position = -1;
         int actual_argument_position = -1;
+        /* the frame is walked along with the formals, an argument is only
+           looked up by name where they do not line up */
+        SEXP binding = find_first_argument_binding_(rho, op);
         for (formal = FORMALS(op); formal != R_NilValue; formal = CDR(formal)) {
             ++formal_parameter_position;
             /* get argument name */
             name = TAG(formal);
-            /* lookup argument in environment by name */
-            argument = dyntrace_lookup_environment(rho, name);
+            if (binding != R_NilValue && TAG(binding) == name) {
+                argument = CAR(binding);
+                binding = CDR(binding);
+            } else {
+                /* lookup argument in environment by name */
+                argument = dyntrace_lookup_environment(rho, name);
+            }
             if (name == R_DotsSymbol) {
                 if (type_of_sexp(argument) == DOTSXP) {
                     for (SEXP dot_dot_dot_arguments = argument;
@@ -0,0 +1,63 @@
+#include "Type.h"
+
+#include "sexptypes.h"
+#include "utilities.h"
+
+Type::Type(sexptype_t type): sexptype_(type) {
+    if (type == JUMPSXP) {
+        top_level_type_ = "jumped";
+    } else if (type == DOTSXP) {
+        top_level_type_ = "...";
+    } else if (type == MISSINGSXP) {
+        top_level_type_ = "any";
+    }
+}
+
+Type::Type(SEXP get_my_type, const std::vector<std::string> tags)
+    : sexptype_(TYPEOF(get_my_type)) {
+
+    /* type */
+
+    // tags first
+    tags_ = tags;
+
+    if (get_my_type == R_MissingArg) {
+        top_level_type_ = "missing";
+    } else {
+        // split if necessary
+        
+        std::string type = get_type_of_sexp(get_my_type);
+        auto loc_of_at = type.find("@");
+        
+        if (loc_of_at == std::string::npos) {
+            // not in
+            top_level_type_ = type;
+        } else {
+            top_level_type_ = type.substr(0, loc_of_at);
+            tags_.push_back(type.substr(loc_of_at+1));
+        }
+    }
+
+    /* class(es) */ /* TODO is this the right way to do this? */
+    // SEXP class_as_charsxp = Rf_S3Class(get_my_type);
+    SEXP class_as_charsxp = Rf_getAttrib(get_my_type, R_ClassSymbol);
+
+    // TODO do i have to check for null here?
+    for (int i = 0; i < LENGTH(class_as_charsxp); i++) {
+        classes_.push_back(CHAR(STRING_ELT(class_as_charsxp, i)));
+    }
+
+    /* attributes */
+    SEXP attrs_as_sxp = ATTRIB(get_my_type);
+    if (attrs_as_sxp == R_NilValue) {
+        // attributes are null
+    } else {
+        SEXP attr_names = getAttrib(attrs_as_sxp, R_NamesSymbol);
+        for (int i = 0; i < LENGTH(attr_names); i++) {
+            attr_names_.push_back(CHAR(STRING_ELT(attr_names, i)));
+
+            // TODO: check if the attr_names[i] is "names", if so, we want to grab the names.
+            
+        }
+    }
+}
@@ -1,70 +1,34 @@
 #ifndef TYPEDYNTRACER_TYPE_H
 #define TYPEDYNTRACER_TYPE_H
 
-#include "utilities.h"
+#include "definitions.h"
+#include "footprint.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/* Type does not depend on R, only its constructors from R values do. This
+   lets tools that read traces back, like the replay tool, use it. */
+typedef struct SEXPREC* SEXP;
 
 class Type {
 
     public:
-    explicit Type(std::string top_level_type) :
-    top_level_type_(top_level_type) {}
-
-    explicit Type(sexptype_t type) {
-        if (type == JUMPSXP) {
-            top_level_type_ = "jumped";
-        } else if (type == DOTSXP) {
-            top_level_type_ = "...";
-        } else if (type == MISSINGSXP) {
-            top_level_type_ = "any";
-        }
-    }
+    /* sexptype of types not made from a value */
+    static const sexptype_t UNKNOWN_SEXPTYPE = ~0u;
 
-    explicit Type(SEXP get_my_type, const std::vector<std::string> tags = {}) {
-
-        /* type */
-
-        // tags first
-        tags_ = tags;
-
-        if (get_my_type == R_MissingArg) {
-            top_level_type_ = "missing";
-        } else {
-            // split if necessary
-            
-            std::string type = get_type_of_sexp(get_my_type);
-            auto loc_of_at = type.find("@");
-            
-            if (loc_of_at == std::string::npos) {
-                // not in
-                top_level_type_ = type;
-            } else {
-                top_level_type_ = type.substr(0, loc_of_at);
-                tags_.push_back(type.substr(loc_of_at+1));
-            }
-        }
+    explicit Type(std::string top_level_type) :
+    top_level_type_(top_level_type), sexptype_(UNKNOWN_SEXPTYPE) {}
 
-        /* class(es) */ /* TODO is this the right way to do this? */
-        // SEXP class_as_charsxp = Rf_S3Class(get_my_type);
-        SEXP class_as_charsxp = Rf_getAttrib(get_my_type, R_ClassSymbol);
+    explicit Type(sexptype_t type);
 
-        // TODO do i have to check for null here?
-        for (int i = 0; i < LENGTH(class_as_charsxp); i++) {
-            classes_.push_back(CHAR(STRING_ELT(class_as_charsxp, i)));
-        }
+    explicit Type(SEXP get_my_type, const std::vector<std::string> tags = {});
 
-        /* attributes */
-        SEXP attrs_as_sxp = ATTRIB(get_my_type);
-        if (attrs_as_sxp == R_NilValue) {
-            // attributes are null
-        } else {
-            SEXP attr_names = getAttrib(attrs_as_sxp, R_NamesSymbol);
-            for (int i = 0; i < LENGTH(attr_names); i++) {
-                attr_names_.push_back(CHAR(STRING_ELT(attr_names, i)));
-
-                // TODO: check if the attr_names[i] is "names", if so, we want to grab the names.
-                
-            }
-        }
+    /* SEXPTYPE of the value this type was made from, or one of the pseudo
+       sexptypes of sexptypes.h */
+    sexptype_t get_sexptype() const {
+        return sexptype_;
     }
 
     std::string get_top_level_type() const {
@@ -111,15 +75,39 @@ class Type {
         return the_hash;
     }
 
+    /* hash_type is only a first check, different types can hash the same */
+    bool operator==(const Type& other) const {
+        return sexptype_ == other.sexptype_ &&
+               top_level_type_ == other.top_level_type_ &&
+               attr_names_ == other.attr_names_ &&
+               classes_ == other.classes_ && tags_ == other.tags_;
+    }
+
+    bool operator!=(const Type& other) const {
+        return !(*this == other);
+    }
+
+    /* approximate number of bytes used by this type */
+    std::size_t get_approximate_size() const {
+        return sizeof(Type) + get_heap_size(top_level_type_) +
+               get_heap_size(attr_names_) + get_heap_size(classes_) +
+               get_heap_size(tags_);
+    }
+
     std::vector<std::string> * get_tags() {
         return & tags_;
     }
 
+    const std::vector<std::string> * get_tags() const {
+        return & tags_;
+    }
+
     private:
     std::string top_level_type_;
     std::vector<std::string> attr_names_;
     std::vector<std::string> classes_;
     std::vector<std::string> tags_;
+    sexptype_t sexptype_;
 
 };
 
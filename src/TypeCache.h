@@ -0,0 +1,92 @@
+#ifndef TYPEDYNTRACER_TYPE_CACHE_H
+#define TYPEDYNTRACER_TYPE_CACHE_H
+
+#include "constants.h"
+#include "definitions.h"
+#include "stdlibs.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Direct-mapped cache from object address to interned type ID. A colliding
+// insert simply evicts the previous entry. Entries have to be invalidated
+// when the object is unmarked by the gc, otherwise a new object allocated at
+// the same address would be given the type of the old one. This is what
+// keeps the cache correct: the tracer does not see gc cycles begin, so they
+// cannot be part of the key.
+class TypeCache {
+  public:
+    explicit TypeCache(std::size_t size): entries_(size), mask_(size - 1) {
+    }
+
+    type_id_t lookup(const SEXP object) const {
+        const Entry& entry = entries_[index_(object)];
+        if (entry.object == object) {
+            return entry.type_id;
+        }
+        return UNASSIGNED_TYPE_ID;
+    }
+
+    void insert(const SEXP object, type_id_t type_id) {
+        Entry& entry = entries_[index_(object)];
+        entry.object = object;
+        entry.type_id = type_id;
+    }
+
+    void invalidate(const SEXP object) {
+        Entry& entry = entries_[index_(object)];
+        if (entry.object == object) {
+            entry.object = nullptr;
+        }
+    }
+
+    /* forgets all the objects */
+    void clear() {
+        std::fill(entries_.begin(), entries_.end(), Entry());
+    }
+
+    std::size_t size() const {
+        return entries_.size();
+    }
+
+    std::size_t get_approximate_size() const {
+        return entries_.capacity() * sizeof(Entry);
+    }
+
+    /* Only vectors and lists are worth caching, the type of everything else
+       is cheap to compute. Objects which are not shared can be modified in
+       place, so their type can change without their address changing. */
+    static bool is_cacheable(const SEXP object) {
+        switch (TYPEOF(object)) {
+        case LGLSXP:
+        case INTSXP:
+        case REALSXP:
+        case CPLXSXP:
+        case STRSXP:
+        case RAWSXP:
+        case VECSXP:
+            return MAYBE_SHARED(object);
+        default:
+            return false;
+        }
+    }
+
+  private:
+    struct Entry {
+        SEXP object = nullptr;
+        type_id_t type_id = UNASSIGNED_TYPE_ID;
+    };
+
+    std::vector<Entry> entries_;
+    const std::size_t mask_;
+
+    std::size_t index_(const SEXP object) const {
+        /* nodes are at least 16 byte aligned, so the low bits carry no
+           information. */
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(object);
+        return ((address >> 4) ^ (address >> 20)) & mask_;
+    }
+};
+
+#endif /* TYPEDYNTRACER_TYPE_CACHE_H */
@@ -0,0 +1,55 @@
+#ifndef TYPEDYNTRACER_TYPE_TABLE_H
+#define TYPEDYNTRACER_TYPE_TABLE_H
+
+#include "Type.h"
+#include "definitions.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Interns types so that a type computed once can be referred to by a small
+// integer ID. Types are looked up by hash and compared in full, since
+// different types can have the same hash, e.g. a class and an attribute
+// with the same name.
+class TypeTable {
+  public:
+    explicit TypeTable(): types_(), ids_(), heap_size_(0) {
+    }
+
+    type_id_t intern(const Type& type) {
+        std::size_t hash = type.hash_type();
+        auto range = ids_.equal_range(hash);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (types_[iter->second] == type) {
+                return iter->second;
+            }
+        }
+        type_id_t id = types_.size();
+        types_.push_back(type);
+        heap_size_ += type.get_approximate_size() - sizeof(Type);
+        ids_.insert({hash, id});
+        return id;
+    }
+
+    const Type& get_type(type_id_t id) const {
+        return types_[id];
+    }
+
+    std::size_t size() const {
+        return types_.size();
+    }
+
+    std::size_t get_approximate_size() const {
+        return types_.capacity() * sizeof(Type) + heap_size_ +
+               get_hash_table_overhead(ids_) +
+               ids_.size() * sizeof(std::pair<const std::size_t, type_id_t>);
+    }
+
+  private:
+    std::vector<Type> types_;
+    std::unordered_multimap<std::size_t, type_id_t> ids_;
+    /* bytes the interned types have allocated outside of types_ */
+    std::size_t heap_size_;
+};
+
+#endif /* TYPEDYNTRACER_TYPE_TABLE_H */
@@ -0,0 +1,51 @@
+#ifndef TYPEDYNTRACER_TYPING_MODE_H
+#define TYPEDYNTRACER_TYPING_MODE_H
+
+#include <string>
+
+// How much type information is recorded for the arguments of a builtin or
+// special.
+enum class TypingMode {
+    // no trace is recorded
+    Off = 0,
+    // only the number of arguments is recorded, every position is 'any'
+    Arity,
+    // only the SEXPTYPE of each argument is recorded
+    SexpType,
+    // the same full types as for closures
+    Full,
+    COUNT
+};
+
+inline std::string to_string(const TypingMode mode) {
+    switch (mode) {
+    case TypingMode::Off:
+        return "off";
+    case TypingMode::Arity:
+        return "arity";
+    case TypingMode::SexpType:
+        return "sexptype";
+    case TypingMode::Full:
+        return "full";
+    case TypingMode::COUNT:
+        return "unknown";
+    }
+
+    return "unknown";
+}
+
+/* returns TypingMode::COUNT if the string does not name a mode */
+inline TypingMode typing_mode_from_string(const std::string& str) {
+    if (str == "off") {
+        return TypingMode::Off;
+    } else if (str == "arity") {
+        return TypingMode::Arity;
+    } else if (str == "sexptype") {
+        return TypingMode::SexpType;
+    } else if (str == "full") {
+        return TypingMode::Full;
+    }
+    return TypingMode::COUNT;
+}
+
+#endif /* TYPEDYNTRACER_TYPING_MODE_H */
@@ -38,3 +38,26 @@ const scope_t UNASSIGNED_SCOPE = "Unassigned";
 const scope_t TOP_LEVEL_SCOPE = "Top Level";
 
 extern const gc_cycle_t UNDEFINED_GC_CYCLE = -1;
+
+const type_id_t UNASSIGNED_TYPE_ID = -1;
+
+/* must be a power of two, the cache is indexed by masking the address */
+const std::size_t TYPE_CACHE_SIZE = 1 << 16;
+
+/* The arguments of control flow and assignment specials are unevaluated
+   expressions and '(' just returns its argument, so their traces carry no
+   useful type information. These can be overridden from R. */
+const std::unordered_map<std::string, TypingMode>
+    DEFAULT_PRIMITIVE_TYPING_MODES{{"{", TypingMode::Off},
+                                   {"(", TypingMode::Off},
+                                   {"if", TypingMode::Off},
+                                   {"for", TypingMode::Off},
+                                   {"while", TypingMode::Off},
+                                   {"repeat", TypingMode::Off},
+                                   {"break", TypingMode::Off},
+                                   {"next", TypingMode::Off},
+                                   {"return", TypingMode::Off},
+                                   {"function", TypingMode::Off},
+                                   {"<-", TypingMode::Off},
+                                   {"<<-", TypingMode::Off},
+                                   {"=", TypingMode::Off}};
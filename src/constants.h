@@ -1,9 +1,11 @@
 #ifndef PROMISEDYNTRACER_CONSTANTS_H
 #define PROMISEDYNTRACER_CONSTANTS_H
 
+#include "TypingMode.h"
 #include "definitions.h"
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 extern const char UNIT_SEPARATOR;
@@ -39,4 +41,10 @@ extern const scope_t UNASSIGNED_SCOPE;
 extern const scope_t TOP_LEVEL_SCOPE;
 
 extern const gc_cycle_t UNDEFINED_GC_CYCLE;
+
+extern const type_id_t UNASSIGNED_TYPE_ID;
+extern const std::size_t TYPE_CACHE_SIZE;
+
+extern const std::unordered_map<std::string, TypingMode>
+    DEFAULT_PRIMITIVE_TYPING_MODES;
 #endif /* PROMISEDYNTRACER_CONSTANTS_H */
@@ -31,4 +31,8 @@ typedef std::string scope_t;
 
 typedef int gc_cycle_t;
 
+typedef unsigned int sexptype_t;
+
+typedef int type_id_t;
+
 #endif /* PROMISEDYNTRACER_DEFINITIONS_H */
@@ -0,0 +1,30 @@
+#ifndef PROMISEDYNTRACER_FOOTPRINT_H
+#define PROMISEDYNTRACER_FOOTPRINT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/* bytes a string has allocated outside of itself, nothing if it fits in the
+   small string buffer */
+inline std::size_t get_heap_size(const std::string& string) {
+    return string.capacity() > 15 ? string.capacity() + 1 : 0;
+}
+
+inline std::size_t get_heap_size(const std::vector<std::string>& strings) {
+    std::size_t size = strings.capacity() * sizeof(std::string);
+    for (const std::string& string: strings) {
+        size += get_heap_size(string);
+    }
+    return size;
+}
+
+/* buckets and per node bookkeeping of a std::unordered_map, not counting the
+   stored values */
+template <typename T>
+inline std::size_t get_hash_table_overhead(const T& table) {
+    return table.bucket_count() * sizeof(void*) +
+           table.size() * (sizeof(void*) + sizeof(std::size_t));
+}
+
+#endif /* PROMISEDYNTRACER_FOOTPRINT_H */
@@ -9,8 +9,15 @@ extern "C" {
 #endif
 
 static const R_CallMethodDef CallEntries[] = {
-    {"create_dyntracer", (DL_FUNC) &create_dyntracer, 7},
+    {"create_dyntracer", (DL_FUNC) &create_dyntracer, 18},
     {"destroy_dyntracer", (DL_FUNC) &destroy_dyntracer, 1},
+    {"tracer_memory_usage", (DL_FUNC) &tracer_memory_usage, 1},
+    {"tracer_stats", (DL_FUNC) &tracer_stats, 1},
+    {"tracer_traces", (DL_FUNC) &tracer_traces, 1},
+    {"begin_session_segment", (DL_FUNC) &begin_session_segment, 2},
+    {"end_session", (DL_FUNC) &end_session, 1},
+    {"write_shared_traces", (DL_FUNC) &write_shared_traces, 3},
+    {"remove_shared_traces", (DL_FUNC) &remove_shared_traces, 1},
     // {"write_data_table", (DL_FUNC) &write_data_table, 5},
     // {"read_data_table", (DL_FUNC) &read_data_table, 3},
     {NULL, NULL, 0}};
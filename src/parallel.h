@@ -0,0 +1,48 @@
+#ifndef TYPEDYNTRACER_PARALLEL_H
+#define TYPEDYNTRACER_PARALLEL_H
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Used by the tools reading the tracer's output, the tracer itself is
+// single threaded.
+
+/* runs body(thread index) on thread_count threads and waits for them. The
+   first exception thrown by a thread is rethrown. */
+template <typename F>
+void run_in_parallel(unsigned int thread_count, F body) {
+    std::vector<std::thread> threads;
+    std::exception_ptr exception;
+    std::mutex exception_mutex;
+
+    for (unsigned int index = 0; index < thread_count; ++index) {
+        threads.emplace_back([&, index]() {
+            try {
+                body(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(exception_mutex);
+                if (!exception) {
+                    exception = std::current_exception();
+                }
+            }
+        });
+    }
+
+    for (std::thread& thread: threads) {
+        thread.join();
+    }
+
+    if (exception) {
+        std::rethrow_exception(exception);
+    }
+}
+
+/* the number of cores, at least 1 */
+inline unsigned int get_default_thread_count() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+#endif /* TYPEDYNTRACER_PARALLEL_H */
@@ -1,6 +1,10 @@
 
 #include "probes.h"
 
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+
 inline TracerState& tracer_state(dyntracer_t* dyntracer) {
     return *(static_cast<TracerState*>(dyntracer->state));
 }
@@ -15,6 +19,37 @@ static inline void set_dispatch(Call* call,
    }
 }
 
+// The state of the dyntrace call in progress, for the fork handlers. See
+// TracerState::enter_fork_child.
+static TracerState* forking_state = nullptr;
+
+static void prepare_fork() {
+    if (forking_state != nullptr) {
+        forking_state->prepare_fork();
+    }
+}
+
+static void exit_fork_child() {
+    if (forking_state == nullptr) {
+        return;
+    }
+    try {
+        forking_state->exit_fork_child();
+    } catch (const std::exception& e) {
+        std::cerr << "unable to write the traces of process " << getpid()
+                  << ": " << e.what() << std::endl;
+    }
+}
+
+static void enter_fork_child() {
+    if (forking_state != nullptr) {
+        forking_state->enter_fork_child();
+        /* for children that exit through exit, parallel's report through
+           sendMaster and exit through mcexit, see closure_entry */
+        std::atexit(exit_fork_child);
+    }
+}
+
 // On entry for the tracer.
 void dyntrace_entry(dyntracer_t* dyntracer, SEXP expression, SEXP environment) {
     TracerState& state = tracer_state(dyntracer);
@@ -25,6 +60,13 @@ void dyntrace_entry(dyntracer_t* dyntracer, SEXP expression, SEXP environment) {
 
     state.initialize();
 
+    static bool fork_handlers_registered = false;
+    if (!fork_handlers_registered) {
+        pthread_atfork(prepare_fork, nullptr, enter_fork_child);
+        fork_handlers_registered = true;
+    }
+    forking_state = &state;
+
     // search_promises(dyntracer, R_BaseEnv);
 
     /* probe_exit here ensures we start the timer for timing argument execution.
@@ -47,10 +89,26 @@ void dyntrace_exit(dyntracer_t* dyntracer,
     /* Force an imaginary GC cycle at program end */
     state.enter_gc();
 
-    state.cleanup(error);
+    // Serialize the traces and write them out. This has to happen before
+    // cleanup, which destroys the functions. In a session, the functions
+    // are kept for the next expression, see TracerState::begin_segment.
+    // An output that cannot be written must not take R down with it.
+    bool in_session = state.is_in_session();
+    try {
+        if (in_session) {
+            state.end_segment(error);
+        } else {
+            state.serialize_and_output();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "unable to write the output of the tracer: " << e.what()
+                  << std::endl;
+    }
+    if (!in_session) {
+        state.cleanup(error);
+    }
 
-    // Serialize the traces and write them out.
-    state.serialize_and_output();
+    forking_state = nullptr;
 
     /* we do not do start.exit_probe() because the tracer has finished
        executing and we don't need to resume the timer. */
@@ -142,12 +200,26 @@ CallTrace deal_with_builtin_and_special(Call* function_call, SEXP args, SEXP ret
                                                 dispatch);
 
     int i = 0;
+
+    // How much we type depends on the primitive, see TypingMode.
+    // TypingMode::Off never gets here.
+    TypingMode mode = function_call->get_function()->get_typing_mode();
     
     for(SEXP cons = args; cons != R_NilValue; cons = CDR(cons)) {
         SEXP el = CAR(cons);
 
         // build up call trace
-        trace_for_this_call.add_to_call_trace(i, Type(el));
+        switch (mode) {
+            case TypingMode::Arity:
+                trace_for_this_call.add_to_call_trace(i, Type(MISSINGSXP));
+                break;
+            case TypingMode::SexpType:
+                trace_for_this_call.add_to_call_trace(i, Type(std::string(type2char(TYPEOF(el)))));
+                break;
+            default:
+                trace_for_this_call.add_to_call_trace(i, state->get_value_type(el));
+                break;
+        }
 
         // dependencies
         // state->get_dependencies().add_argument(el, function_call->get_function()->get_id(), i);
@@ -156,7 +228,17 @@ CallTrace deal_with_builtin_and_special(Call* function_call, SEXP args, SEXP ret
     }
 
     // return value
-    trace_for_this_call.add_to_call_trace(-1, Type(return_value));
+    switch (mode) {
+        case TypingMode::Arity:
+            trace_for_this_call.add_to_call_trace(-1, Type(MISSINGSXP));
+            break;
+        case TypingMode::SexpType:
+            trace_for_this_call.add_to_call_trace(-1, Type(std::string(type2char(TYPEOF(return_value)))));
+            break;
+        default:
+            trace_for_this_call.add_to_call_trace(-1, state->get_value_type(return_value));
+            break;
+    }
     // state->get_dependencies().add_argument(return_value, function_call->get_function()->get_id(), -1, trace_for_this_call.compute_hash());
 
     return trace_for_this_call;
@@ -191,6 +273,16 @@ void closure_entry(dyntracer_t* dyntracer,
     Call* function_call = state.create_call(call, op, args, rho);
     set_dispatch(function_call, dispatch);
 
+    /* a forked child writes its shard before it sends its result, the
+       parent can kill it once it has all the results or be done before it
+       exits, and mcexit ends it with _exit, which skips atexit */
+    if (state.is_fork_child() &&
+        (function_call->get_function_name() == "sendMaster" ||
+         function_call->get_function_name() == "mcexit") &&
+        function_call->get_function()->get_namespace() == "parallel") {
+        exit_fork_child();
+    }
+
     // Set up the call trace of the function call.
     function_call->set_call_trace(state.create_call_trace(function_call->get_function()->get_namespace(), 
                                   function_call->get_function_name(), function_call->get_function()->get_id(),
@@ -223,7 +315,7 @@ void closure_entry(dyntracer_t* dyntracer,
                 //
 
                 // add the type to the call trace.
-                function_call->get_call_trace()->add_to_call_trace(arg->get_formal_parameter_position(), Type(value, tags));
+                function_call->get_call_trace()->add_to_call_trace(arg->get_formal_parameter_position(), state.get_value_type(value));
             }
         }
 
@@ -264,7 +356,7 @@ void closure_entry(dyntracer_t* dyntracer,
                     //     tags.push_back(state.lookup_function(val)->get_id());
                     // }
 
-                    function_call->get_call_trace()->add_to_call_trace(param_pos, Type(val, tags));
+                    function_call->get_call_trace()->add_to_call_trace(param_pos, state.get_value_type(val));
                 } else {
                     // If the type of old_expr is symbol or language, then it's missing.
                     the_type = type_of_sexp(old_expr);
@@ -377,9 +469,12 @@ void closure_exit(dyntracer_t* dyntracer,
     //     tags.push_back(state.lookup_function(val)->get_id());
     // }
 
-    ct.add_to_call_trace(-1, Type(val, tags));
+    ct.add_to_call_trace(-1, state.get_value_type(val));
 
-    // state.get_dependencies().add_return(val, function_call->get_function()->get_id(), ct.compute_hash());
+    // Not keyed by the trace hash, that would make a node per trace.
+    if (state.is_tracking_dependencies()) {
+        state.get_dependencies().add_return(val, fn_id);
+    }
 
     state.deal_with_call_trace(ct); 
 
@@ -402,9 +497,11 @@ void builtin_entry(dyntracer_t* dyntracer,
     Call* function_call = state.create_call(call, op, args, rho);
     set_dispatch(function_call, dispatch);
 
-    function_call->set_call_trace(state.create_call_trace(function_call->get_function()->get_namespace(), 
-                                  function_call->get_function_name(), function_call->get_function()->get_id(),
-                                  dispatch));
+    if (function_call->get_function()->get_typing_mode() != TypingMode::Off) {
+        function_call->set_call_trace(state.create_call_trace(function_call->get_function()->get_namespace(), 
+                                      function_call->get_function_name(), function_call->get_function()->get_id(),
+                                      dispatch));
+    }
 
     state.push_stack(function_call);
 
@@ -433,7 +530,9 @@ void builtin_exit(dyntracer_t* dyntracer,
         dyntrace_log_error("Not found matching builtin on stack");
     }
     Call* function_call = exec_ctxt.get_builtin();
-    state.deal_with_call_trace(deal_with_builtin_and_special(function_call, args, return_value, &state, dispatch));
+    if (function_call->get_function()->get_typing_mode() != TypingMode::Off) {
+        state.deal_with_call_trace(deal_with_builtin_and_special(function_call, args, return_value, &state, dispatch), true);
+    }
 
     function_call->set_return_value_type(type_of_sexp(return_value));
     state.notify_caller(function_call);
@@ -460,9 +559,11 @@ void special_entry(dyntracer_t* dyntracer,
     Call* function_call = state.create_call(call, op, args, rho);
     set_dispatch(function_call, dispatch);
 
-    function_call->set_call_trace(state.create_call_trace(function_call->get_function()->get_namespace(), 
-                                  function_call->get_function_name(), function_call->get_function()->get_id(),
-                                  dispatch));
+    if (function_call->get_function()->get_typing_mode() != TypingMode::Off) {
+        function_call->set_call_trace(state.create_call_trace(function_call->get_function()->get_namespace(), 
+                                      function_call->get_function_name(), function_call->get_function()->get_id(),
+                                      dispatch));
+    }
                                   
     state.push_stack(function_call);
 
@@ -491,7 +592,9 @@ void special_exit(dyntracer_t* dyntracer,
         dyntrace_log_error("Not found matching special object on stack");
     }
     Call* function_call = exec_ctxt.get_special();
-    state.deal_with_call_trace(deal_with_builtin_and_special(function_call, args, return_value, &state, dispatch));
+    if (function_call->get_function()->get_typing_mode() != TypingMode::Off) {
+        state.deal_with_call_trace(deal_with_builtin_and_special(function_call, args, return_value, &state, dispatch), true);
+    }
 
     function_call->set_return_value_type(type_of_sexp(return_value));
     state.notify_caller(function_call);
@@ -579,13 +682,14 @@ void promise_force_exit(dyntracer_t* dyntracer, const SEXP promise) {
             // }
 
             // add the type to the call trace.
-            ct->add_to_call_trace(param_pos, Type(value, tags));
+            ct->add_to_call_trace(param_pos, state.get_value_type(value));
 
             // DEBUG:
             // std::cout << ct->get_function_name() << " " << ct->get_call_trace().at(param_pos).get_top_level_type() << "\n";
 
-            // put it
-            // state.get_dependencies().add_argument(value, fn_id, param_pos);
+            if (state.is_tracking_dependencies()) {
+                state.get_dependencies().add_argument(value, fn_id, param_pos);
+            }
         }
     }
 
@@ -607,7 +711,12 @@ void gc_unmark(dyntracer_t* dyntracer, const SEXP object) {
    state.enter_probe(Event::GcUnmark);
 
    // try to remove anytime the gc unmarks
-   // state.get_dependencies().remove_value(object);
+   if (state.is_tracking_dependencies()) {
+       state.get_dependencies().remove_value(object);
+   }
+
+   // the address can be reused for a new object after this point
+   state.invalidate_value_type(object);
 
    switch (TYPEOF(object)) {
    case PROMSXP:
@@ -669,9 +778,11 @@ void jump_single_context(TracerState& state,
                 //     tags.push_back(state.lookup_function(return_value)->get_id());
                 // }
 
-                ct.add_to_call_trace(-1, Type(return_value, tags));
+                ct.add_to_call_trace(-1, state.get_value_type(return_value));
 
-                // state.get_dependencies().add_return(return_value, call->get_function()->get_id(), ct.compute_hash());
+                if (state.is_tracking_dependencies()) {
+                    state.get_dependencies().add_return(return_value, fn_id);
+                }
             }
 
             state.deal_with_call_trace(ct); 
@@ -707,23 +818,28 @@ void context_jump(dyntracer_t* dyntracer,
   loop breaks after the first such promise is found. This is
   because only one promise can be held responsible for non local
   return, the one that invokes the return function. */
-   execution_contexts_t exec_ctxts(state.unwind_stack(context));
+   /* The unwound contexts are processed in place, innermost first, and
+      popped one at a time. Only the outermost one gets the type of the
+      return value, unless it is the only one. */
+   std::size_t begin = state.begin_unwind(context);
+   std::size_t end = state.get_stack_size();
    const SEXP rho = context->cloenv;
-   std::size_t context_count = exec_ctxts.size();
-   if (context_count == 0) {
-   } else if (context_count == 1) {
-       jump_single_context(state, exec_ctxts.front(), false, JUMPSXP, return_value, rho); // 
-   } else {
-       auto begin_iter = exec_ctxts.begin();
-       auto end_iter = --exec_ctxts.end();
-       bool returned =
-           (begin_iter->is_special() &&
-            begin_iter->get_special()->get_function()->is_return());
-       for (auto iter = begin_iter; iter != end_iter; ++iter) {
-           jump_single_context(state, *iter, returned, JUMPSXP, return_value, rho);
-       }
-       jump_single_context(
-           state, *end_iter, returned, type_of_sexp(return_value), return_value, rho);
+   std::size_t context_count = end - begin;
+   bool returned = false;
+   if (context_count > 1) {
+       ExecutionContext& innermost = state.get_stack_context(end - 1);
+       returned = (innermost.is_special() &&
+                   innermost.get_special()->get_function()->is_return());
+   }
+   for (std::size_t index = end; index > begin; --index) {
+       bool outermost = context_count > 1 && index - 1 == begin;
+       jump_single_context(state,
+                           state.get_stack_context(index - 1),
+                           returned,
+                           outermost ? type_of_sexp(return_value) : JUMPSXP,
+                           return_value,
+                           rho);
+       state.end_unwind(index - 1);
    }
    state.exit_probe(Event::ContextJump);
 }
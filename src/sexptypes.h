@@ -1,10 +1,9 @@
 #ifndef PROMISEDYNTRACER_SEXPTYPES_H
 #define PROMISEDYNTRACER_SEXPTYPES_H
 
+#include "definitions.h"
 #include "stdlibs.h"
 
-typedef unsigned int sexptype_t;
-
 extern const sexptype_t UNBOUNDSXP;
 extern const sexptype_t UNASSIGNEDSXP;
 extern const sexptype_t MISSINGSXP;
@@ -0,0 +1,73 @@
+#ifndef PROMISEDYNTRACER_TIMING_H
+#define PROMISEDYNTRACER_TIMING_H
+
+#include <chrono>
+#include <cstdint>
+
+/* Execution time of the traced code is measured around every probe. Build
+   with EXECUTION_TIMING=0 (see Makevars) to compile that out entirely. */
+#ifndef EXECUTION_TIMING
+#    define EXECUTION_TIMING 1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <x86intrin.h>
+#endif
+
+/* A cheap, monotonically increasing counter. On x86 this is the time stamp
+   counter, which does not serialize the pipeline and costs a few dozen
+   cycles, unlike a call through the chrono clocks. The unit is
+   platform-specific. */
+inline std::uint64_t read_cycle_counter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    std::uint64_t counter;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(counter));
+    return counter;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+inline const char* get_cycle_counter_name() {
+#if defined(__x86_64__) || defined(__i386__)
+    return "rdtsc";
+#elif defined(__aarch64__)
+    return "cntvct_el0";
+#else
+    return "steady_clock";
+#endif
+}
+
+/* Measures the cycle counter against the steady clock. This busy waits for
+   a few milliseconds so it is only done once, see
+   get_cycle_counter_ticks_per_nanosecond. */
+inline double calibrate_cycle_counter() {
+    using clock = std::chrono::steady_clock;
+    const auto start_time = clock::now();
+    const std::uint64_t start_ticks = read_cycle_counter();
+    auto end_time = start_time;
+    while (end_time - start_time < std::chrono::milliseconds(10)) {
+        end_time = clock::now();
+    }
+    const std::uint64_t end_ticks = read_cycle_counter();
+    const double nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end_time -
+                                                             start_time)
+            .count();
+    return (end_ticks - start_ticks) / nanoseconds;
+}
+
+inline double get_cycle_counter_ticks_per_nanosecond() {
+    static const double ticks_per_nanosecond = calibrate_cycle_counter();
+    return ticks_per_nanosecond;
+}
+
+inline std::uint64_t ticks_to_nanoseconds(std::uint64_t ticks) {
+    return ticks / get_cycle_counter_ticks_per_nanosecond();
+}
+
+#endif /* PROMISEDYNTRACER_TIMING_H */
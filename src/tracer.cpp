@@ -2,7 +2,12 @@
 
 #include <Rdyntrace.h>
 
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <csignal>
+#include <cstdio>
+#include <limits>
 
 #include "probes.h"
 
@@ -11,8 +16,125 @@ extern "C" {
 dyntracer_t* dyntracer_;
 
 void handleSignal(int signum) {
-    if (signum == SIGTERM) {
-        (static_cast<TracerState*>(dyntracer_->state))->serialize_and_output();
+    if (signum != SIGTERM) {
+        return;
+    }
+    TracerState* state = static_cast<TracerState*>(dyntracer_->state);
+    /* writing a shard is not async-signal-safe, so a forked child dies as it
+       would untraced. its shard is written from sendMaster, mcexit and
+       atexit, see probes.cpp */
+    if (state->is_fork_child()) {
+        signal(SIGTERM, SIG_DFL);
+        raise(SIGTERM);
+        return;
+    }
+    try {
+        state->serialize_and_output();
+    } catch (const std::exception& e) {
+        std::cerr << "unable to write the output of the tracer: " << e.what()
+                  << std::endl;
+    }
+}
+
+static bool is_typing_mode(SEXP mode) {
+    return typing_mode_from_string(CHAR(mode)) != TypingMode::COUNT;
+}
+
+/* Rf_error does not return, so the modes are checked before any C++ object
+   is built from them */
+static void check_typing_modes(SEXP primitive_typing_modes,
+                               SEXP default_primitive_typing_mode) {
+    SEXP names = getAttrib(primitive_typing_modes, R_NamesSymbol);
+    if (LENGTH(primitive_typing_modes) > 0 && names == R_NilValue) {
+        Rf_error("primitive_typing_modes should be named by primitive");
+    }
+    for (int i = 0; i < LENGTH(primitive_typing_modes); ++i) {
+        SEXP mode = STRING_ELT(primitive_typing_modes, i);
+        if (!is_typing_mode(mode)) {
+            Rf_error("unknown typing mode '%s'", CHAR(mode));
+        }
+    }
+    SEXP mode = STRING_ELT(default_primitive_typing_mode, 0);
+    if (!is_typing_mode(mode)) {
+        Rf_error("unknown typing mode '%s'", CHAR(mode));
+    }
+}
+
+/* the mode has to be checked, see check_typing_modes */
+static TypingMode sexp_to_typing_mode(SEXP mode) {
+    return typing_mode_from_string(CHAR(mode));
+}
+
+/* primitive_typing_modes is a character vector of modes named by primitive */
+static std::unordered_map<std::string, TypingMode>
+sexp_to_typing_modes(SEXP primitive_typing_modes) {
+    std::unordered_map<std::string, TypingMode> typing_modes;
+    SEXP names = getAttrib(primitive_typing_modes, R_NamesSymbol);
+    for (int i = 0; i < LENGTH(primitive_typing_modes); ++i) {
+        typing_modes.insert_or_assign(
+            CHAR(STRING_ELT(names, i)),
+            sexp_to_typing_mode(STRING_ELT(primitive_typing_modes, i)));
+    }
+    return typing_modes;
+}
+
+/* Attaching to the shared traces or connecting to the aggregator can fail.
+   Rf_error does not return, so it cannot be called while the C++ objects
+   made here are alive: the message is copied to error_message and nullptr
+   is returned instead. */
+static TracerState* new_tracer_state(SEXP output_dirpath,
+                                     SEXP package_under_analysis,
+                                     SEXP analyzed_file_name,
+                                     SEXP verbose,
+                                     SEXP truncate,
+                                     SEXP binary,
+                                     SEXP compression_level,
+                                     SEXP primitive_typing_modes,
+                                     SEXP default_primitive_typing_mode,
+                                     SEXP profile_probes,
+                                     SEXP memory_sampling_interval,
+                                     SEXP record_events,
+                                     SEXP wide_traces,
+                                     SEXP track_dependencies,
+                                     SEXP trace_memory_limit,
+                                     SEXP shared_traces,
+                                     SEXP shared_traces_size,
+                                     SEXP trace_socket,
+                                     char* error_message,
+                                     std::size_t error_message_size) {
+    TypingMode default_typing_mode =
+        sexp_to_typing_mode(STRING_ELT(default_primitive_typing_mode, 0));
+    std::unordered_map<std::string, TypingMode> typing_modes =
+        sexp_to_typing_modes(primitive_typing_modes);
+
+    try {
+        return new TracerState(sexp_to_string(output_dirpath),
+                               sexp_to_string(package_under_analysis),
+                               sexp_to_string(analyzed_file_name),
+                               sexp_to_bool(verbose),
+                               sexp_to_bool(truncate),
+                               sexp_to_bool(binary),
+                               sexp_to_int(compression_level),
+                               typing_modes,
+                               default_typing_mode,
+                               sexp_to_bool(profile_probes),
+                               sexp_to_int(memory_sampling_interval),
+                               sexp_to_bool(record_events),
+                               sexp_to_bool(wide_traces),
+                               sexp_to_bool(track_dependencies),
+                               /* in MiB */
+                               static_cast<std::size_t>(
+                                   sexp_to_int(trace_memory_limit))
+                                   << 20,
+                               sexp_to_string(shared_traces),
+                               /* in MiB */
+                               static_cast<std::size_t>(
+                                   sexp_to_int(shared_traces_size))
+                                   << 20,
+                               sexp_to_string(trace_socket));
+    } catch (const std::runtime_error& e) {
+        std::snprintf(error_message, error_message_size, "%s", e.what());
+        return nullptr;
     }
 }
 
@@ -22,14 +144,45 @@ SEXP create_dyntracer(SEXP output_dirpath,
                       SEXP verbose,
                       SEXP truncate,
                       SEXP binary,
-                      SEXP compression_level) {
-    void* state = new TracerState(sexp_to_string(output_dirpath),
-                                  sexp_to_string(package_under_analysis),
-                                  sexp_to_string(analyzed_file_name),
-                                  sexp_to_bool(verbose),
-                                  sexp_to_bool(truncate),
-                                  sexp_to_bool(binary),
-                                  sexp_to_int(compression_level));
+                      SEXP compression_level,
+                      SEXP primitive_typing_modes,
+                      SEXP default_primitive_typing_mode,
+                      SEXP profile_probes,
+                      SEXP memory_sampling_interval,
+                      SEXP record_events,
+                      SEXP wide_traces,
+                      SEXP track_dependencies,
+                      SEXP trace_memory_limit,
+                      SEXP shared_traces,
+                      SEXP shared_traces_size,
+                      SEXP trace_socket) {
+    /* validate these before anything is allocated since they can error */
+    check_typing_modes(primitive_typing_modes, default_primitive_typing_mode);
+
+    char error_message[1024] = "";
+    TracerState* state = new_tracer_state(output_dirpath,
+                                          package_under_analysis,
+                                          analyzed_file_name,
+                                          verbose,
+                                          truncate,
+                                          binary,
+                                          compression_level,
+                                          primitive_typing_modes,
+                                          default_primitive_typing_mode,
+                                          profile_probes,
+                                          memory_sampling_interval,
+                                          record_events,
+                                          wide_traces,
+                                          track_dependencies,
+                                          trace_memory_limit,
+                                          shared_traces,
+                                          shared_traces_size,
+                                          trace_socket,
+                                          error_message,
+                                          sizeof(error_message));
+    if (state == nullptr) {
+        Rf_error("%s", error_message);
+    }
 
     std::cout << "creating dyntracer, and tracing...\n\n";
 
@@ -90,6 +243,349 @@ SEXP create_dyntracer(SEXP output_dirpath,
     return dyntracer_to_sexp(dyntracer, "dyntracer.promise");
 }
 
+static TracerState* sexp_to_tracer_state(SEXP dyntracer_sexp) {
+    dyntracer_t* dyntracer = dyntracer_from_sexp(dyntracer_sexp);
+    if (dyntracer == NULL) {
+        Rf_error("dyntracer has already been destroyed");
+    }
+    return static_cast<TracerState*>(dyntracer->state);
+}
+
+SEXP tracer_memory_usage(SEXP dyntracer_sexp) {
+    std::vector<memory_usage_t> usages =
+        sexp_to_tracer_state(dyntracer_sexp)->get_memory_usage();
+
+    SEXP structures = PROTECT(allocVector(STRSXP, usages.size()));
+    /* counts can exceed the range of integers */
+    SEXP objects = PROTECT(allocVector(REALSXP, usages.size()));
+    SEXP bytes = PROTECT(allocVector(REALSXP, usages.size()));
+    for (std::size_t i = 0; i < usages.size(); ++i) {
+        SET_STRING_ELT(structures, i, mkChar(usages[i].structure.c_str()));
+        REAL(objects)[i] = usages[i].objects;
+        REAL(bytes)[i] = usages[i].bytes;
+    }
+
+    SEXP usage = PROTECT(allocVector(VECSXP, 3));
+    SET_VECTOR_ELT(usage, 0, structures);
+    SET_VECTOR_ELT(usage, 1, objects);
+    SET_VECTOR_ELT(usage, 2, bytes);
+
+    SEXP names = PROTECT(allocVector(STRSXP, 3));
+    SET_STRING_ELT(names, 0, mkChar("structure"));
+    SET_STRING_ELT(names, 1, mkChar("objects"));
+    SET_STRING_ELT(names, 2, mkChar("bytes"));
+    setAttrib(usage, R_NamesSymbol, names);
+
+    UNPROTECT(5);
+    return usage;
+}
+
+SEXP tracer_stats(SEXP dyntracer_sexp) {
+    const TracerState* state = sexp_to_tracer_state(dyntracer_sexp);
+
+    const std::vector<unsigned long int>& event_counts =
+        state->get_event_counts();
+    SEXP events = PROTECT(allocVector(REALSXP, event_counts.size()));
+    SEXP event_names = PROTECT(allocVector(STRSXP, event_counts.size()));
+    for (std::size_t i = 0; i < event_counts.size(); ++i) {
+        REAL(events)[i] = event_counts[i];
+        SET_STRING_ELT(event_names,
+                       i,
+                       mkChar(to_string(static_cast<Event>(i)).c_str()));
+    }
+    setAttrib(events, R_NamesSymbol, event_names);
+
+    /* the last element of memory usage is the total */
+    std::size_t bytes = state->get_memory_usage().back().bytes;
+
+    /* counts can exceed the range of integers */
+    const std::vector<std::pair<const char*, double>> counts{
+        {"distinct_traces", (double) state->get_distinct_trace_count()},
+        {"traced_calls", (double) state->get_traced_call_count()},
+        {"live_promises", (double) state->get_live_promise_count()},
+        {"functions", (double) state->get_function_count()},
+        {"bytes", (double) bytes},
+        {"timestamp", (double) state->get_timestamp()},
+        {"gc_cycle", (double) state->get_gc_cycle()}};
+
+    SEXP stats = PROTECT(allocVector(VECSXP, counts.size() + 1));
+    SEXP names = PROTECT(allocVector(STRSXP, counts.size() + 1));
+    for (std::size_t i = 0; i < counts.size(); ++i) {
+        SET_VECTOR_ELT(stats, i, ScalarReal(counts[i].second));
+        SET_STRING_ELT(names, i, mkChar(counts[i].first));
+    }
+    SET_VECTOR_ELT(stats, counts.size(), events);
+    SET_STRING_ELT(names, counts.size(), mkChar("events"));
+    setAttrib(stats, R_NamesSymbol, names);
+
+    UNPROTECT(4);
+    return stats;
+}
+
+/* a data frame of row_count rows with the given columns, to be filled by
+   the caller */
+static SEXP create_data_frame(std::size_t column_count,
+                              const char* const* column_names,
+                              const SEXPTYPE* column_types,
+                              int row_count) {
+    SEXP data_frame = PROTECT(allocVector(VECSXP, column_count));
+    SEXP names = PROTECT(allocVector(STRSXP, column_count));
+    for (std::size_t i = 0; i < column_count; ++i) {
+        SET_VECTOR_ELT(data_frame, i, allocVector(column_types[i], row_count));
+        SET_STRING_ELT(names, i, mkChar(column_names[i]));
+    }
+    setAttrib(data_frame, R_NamesSymbol, names);
+
+    /* compact row names, as data.frame makes them */
+    SEXP row_names = PROTECT(allocVector(INTSXP, 2));
+    INTEGER(row_names)[0] = NA_INTEGER;
+    INTEGER(row_names)[1] = -row_count;
+    setAttrib(data_frame, R_RowNamesSymbol, row_names);
+    setAttrib(data_frame, R_ClassSymbol, mkString("data.frame"));
+
+    UNPROTECT(3);
+    return data_frame;
+}
+
+/* a CHARSXP of the decimal digits of value */
+static SEXP mkchar_from_size(std::size_t value) {
+    char digits[std::numeric_limits<std::size_t>::digits10 + 2];
+    *std::to_chars(digits, digits + sizeof(digits) - 1, value).ptr = '\0';
+    return mkChar(digits);
+}
+
+// What tracer_traces builds its data frames from. An R allocation that
+// fails longjmps over the destructors of the C++ objects on the stack, so
+// the objects live here, owned by an external pointer whose finalizer
+// deletes them.
+struct traces_frames_t {
+    std::vector<TraceTable::sorted_trace_t> traces;
+    /* ids are given in order of first use, like in the normalized traces
+       files. A function is its package, name and id. */
+    std::vector<const CallTrace*> functions;
+    std::vector<int> trace_function_ids;
+    TypeTable types;
+    /* type, classes and attrs of each type */
+    std::vector<std::array<std::string, 3>> type_columns;
+    std::vector<std::string> position_column_names;
+    std::vector<const char*> trace_column_names;
+    std::vector<SEXPTYPE> trace_column_types;
+};
+
+static void delete_traces_frames(SEXP frames_sexp) {
+    delete static_cast<traces_frames_t*>(R_ExternalPtrAddr(frames_sexp));
+    R_ClearExternalPtr(frames_sexp);
+}
+
+static void collect_traces(const TracerState* state, traces_frames_t& frames) {
+    frames.traces = state->get_trace_table().get_table().get_sorted_traces();
+    int trace_count = frames.traces.size();
+
+    std::unordered_map<std::string, int> function_ids;
+    frames.trace_function_ids.resize(trace_count);
+    std::size_t position_count = 2;
+    for (int i = 0; i < trace_count; ++i) {
+        const CallTrace& trace = *frames.traces[i].trace;
+        std::string key = trace.get_package_name() + '\n' +
+                          trace.get_function_name() + '\n' +
+                          trace.get_fn_id();
+        auto inserted = function_ids.insert({key, frames.functions.size()});
+        if (inserted.second) {
+            frames.functions.push_back(&trace);
+        }
+        frames.trace_function_ids[i] = inserted.first->second;
+        position_count = std::max<std::size_t>(
+            position_count, TraceTable::get_last_position(trace) + 2);
+    }
+
+    /* the hashes do not fit in doubles, they are kept as strings */
+    frames.trace_column_names = {"package_being_analyzed",
+                                 "trace_hash",
+                                 "function_id",
+                                 "type_hash",
+                                 "dispatch",
+                                 "has_dots",
+                                 "count",
+                                 "type_r"};
+    frames.trace_column_types = {
+        STRSXP, STRSXP, INTSXP, STRSXP, STRSXP, INTSXP, REALSXP, INTSXP};
+    for (std::size_t i = 0; i + 1 < position_count; ++i) {
+        frames.position_column_names.push_back("type" + std::to_string(i));
+    }
+    for (const std::string& name: frames.position_column_names) {
+        frames.trace_column_names.push_back(name.c_str());
+        frames.trace_column_types.push_back(INTSXP);
+    }
+}
+
+SEXP tracer_traces(SEXP dyntracer_sexp) {
+    const TracerState* state = sexp_to_tracer_state(dyntracer_sexp);
+    if (state->get_trace_table().has_spilled()) {
+        Rf_error("the traces were spilled to disk, read the traces files");
+    }
+    if (state->is_sharing_traces()) {
+        Rf_error("the traces are in shared memory, see write_shared_traces");
+    }
+    if (state->is_streaming_traces()) {
+        Rf_error("the traces were sent to the aggregator");
+    }
+
+    SEXP frames_sexp = PROTECT(R_MakeExternalPtr(NULL, R_NilValue, R_NilValue));
+    R_RegisterCFinalizer(frames_sexp, delete_traces_frames);
+    traces_frames_t* frames = new traces_frames_t();
+    R_SetExternalPtrAddr(frames_sexp, frames);
+    collect_traces(state, *frames);
+
+    const std::vector<TraceTable::sorted_trace_t>& traces = frames->traces;
+    int trace_count = traces.size();
+
+    SEXP result = PROTECT(allocVector(VECSXP, 3));
+    SEXP result_names = PROTECT(allocVector(STRSXP, 3));
+    setAttrib(result, R_NamesSymbol, result_names);
+    SET_STRING_ELT(result_names, 0, mkChar("types"));
+    SET_STRING_ELT(result_names, 1, mkChar("functions"));
+    SET_STRING_ELT(result_names, 2, mkChar("traces"));
+
+    SEXP traces_sexp = create_data_frame(frames->trace_column_names.size(),
+                                         frames->trace_column_names.data(),
+                                         frames->trace_column_types.data(),
+                                         trace_count);
+    SET_VECTOR_ELT(result, 2, traces_sexp);
+
+    SEXP package_under_analysis =
+        PROTECT(mkChar(state->get_package_under_analysis().c_str()));
+    for (int i = 0; i < trace_count; ++i) {
+        const CallTrace& trace = *traces[i].trace;
+        SET_STRING_ELT(VECTOR_ELT(traces_sexp, 0), i, package_under_analysis);
+        SET_STRING_ELT(
+            VECTOR_ELT(traces_sexp, 1), i, mkchar_from_size(traces[i].hash));
+        INTEGER(VECTOR_ELT(traces_sexp, 2))[i] = frames->trace_function_ids[i];
+        SET_STRING_ELT(VECTOR_ELT(traces_sexp, 3),
+                       i,
+                       mkchar_from_size(trace.compute_hash_just_for_types()));
+        SET_STRING_ELT(
+            VECTOR_ELT(traces_sexp, 4),
+            i,
+            mkChar(TraceTable::get_dispatch_name(trace.get_dispatch_type())));
+        INTEGER(VECTOR_ELT(traces_sexp, 5))[i] = trace.get_has_dots();
+        REAL(VECTOR_ELT(traces_sexp, 6))[i] = traces[i].count;
+    }
+
+    /* one column of type ids per position, NA where there is no type */
+    int position_count = frames->position_column_names.size() + 1;
+    for (int position = -1; position + 1 < position_count; ++position) {
+        std::fill_n(INTEGER(VECTOR_ELT(traces_sexp, 8 + position)),
+                    trace_count,
+                    NA_INTEGER);
+    }
+    for (int i = 0; i < trace_count; ++i) {
+        const CallTrace& trace = *traces[i].trace;
+        int last_position = TraceTable::get_last_position(trace);
+        for (int position = -1; position <= last_position; ++position) {
+            auto iter = trace.get_call_trace().find(position);
+            if (iter != trace.get_call_trace().end()) {
+                INTEGER(VECTOR_ELT(traces_sexp, 8 + position))[i] =
+                    frames->types.intern(iter->second);
+            }
+        }
+    }
+
+    int type_count = frames->types.size();
+    for (int i = 0; i < type_count; ++i) {
+        const Type& type = frames->types.get_type(i);
+        frames->type_columns.push_back(
+            {TraceTable::get_type_name(type),
+             TraceTable::get_name_list(type.get_classes()),
+             TraceTable::get_name_list(type.get_attr_names())});
+    }
+
+    static const char* const TYPE_COLUMN_NAMES[] = {
+        "type_id", "type", "classes", "attrs"};
+    static const SEXPTYPE TYPE_COLUMN_TYPES[] = {
+        INTSXP, STRSXP, STRSXP, STRSXP};
+    SEXP types_sexp = create_data_frame(
+        4, TYPE_COLUMN_NAMES, TYPE_COLUMN_TYPES, type_count);
+    SET_VECTOR_ELT(result, 0, types_sexp);
+    for (int i = 0; i < type_count; ++i) {
+        INTEGER(VECTOR_ELT(types_sexp, 0))[i] = i;
+        for (int column = 0; column < 3; ++column) {
+            SET_STRING_ELT(VECTOR_ELT(types_sexp, 1 + column),
+                           i,
+                           mkChar(frames->type_columns[i][column].c_str()));
+        }
+    }
+
+    static const char* const FUNCTION_COLUMN_NAMES[] = {
+        "function_id", "package", "fun_name", "fun_id"};
+    static const SEXPTYPE FUNCTION_COLUMN_TYPES[] = {
+        INTSXP, STRSXP, STRSXP, STRSXP};
+    int function_count = frames->functions.size();
+    SEXP functions_sexp = create_data_frame(
+        4, FUNCTION_COLUMN_NAMES, FUNCTION_COLUMN_TYPES, function_count);
+    SET_VECTOR_ELT(result, 1, functions_sexp);
+    for (int i = 0; i < function_count; ++i) {
+        const CallTrace& function = *frames->functions[i];
+        INTEGER(VECTOR_ELT(functions_sexp, 0))[i] = i;
+        SET_STRING_ELT(VECTOR_ELT(functions_sexp, 1),
+                       i,
+                       mkChar(function.get_package_name().c_str()));
+        SET_STRING_ELT(VECTOR_ELT(functions_sexp, 2),
+                       i,
+                       mkChar(function.get_function_name().c_str()));
+        SET_STRING_ELT(VECTOR_ELT(functions_sexp, 3),
+                       i,
+                       mkChar(function.get_fn_id().c_str()));
+    }
+
+    delete_traces_frames(frames_sexp);
+    UNPROTECT(4);
+    return result;
+}
+
+SEXP begin_session_segment(SEXP dyntracer_sexp, SEXP analyzed_file_name) {
+    TracerState* state = sexp_to_tracer_state(dyntracer_sexp);
+    /* the traces files of the segment are named after it */
+    if (*CHAR(STRING_ELT(analyzed_file_name, 0)) == '\0') {
+        Rf_error("analyzed_file_name should not be empty");
+    }
+    state->begin_segment(sexp_to_string(analyzed_file_name));
+    return R_NilValue;
+}
+
+SEXP end_session(SEXP dyntracer_sexp) {
+    sexp_to_tracer_state(dyntracer_sexp)->end_session();
+    return R_NilValue;
+}
+
+SEXP write_shared_traces(SEXP name, SEXP output_filepath, SEXP format) {
+    TracesFormat traces_format =
+        traces_format_from_string(sexp_to_string(format));
+    if (traces_format == TracesFormat::COUNT) {
+        Rf_error("unknown traces format '%s'", CHAR(STRING_ELT(format, 0)));
+    }
+
+    char error_message[1024] = "";
+    try {
+        SharedTraceTable(sexp_to_string(name))
+            .serialize(sexp_to_string(output_filepath), traces_format);
+        return R_NilValue;
+    } catch (const std::runtime_error& e) {
+        std::snprintf(error_message, sizeof(error_message), "%s", e.what());
+    }
+    Rf_error("%s", error_message);
+}
+
+SEXP remove_shared_traces(SEXP name) {
+    char error_message[1024] = "";
+    try {
+        SharedTraceTable::remove(sexp_to_string(name));
+        return R_NilValue;
+    } catch (const std::runtime_error& e) {
+        std::snprintf(error_message, sizeof(error_message), "%s", e.what());
+    }
+    Rf_error("%s", error_message);
+}
+
 static void destroy_promise_dyntracer(dyntracer_t* dyntracer) {
     /* free dyntracer iff it has not already been freed.
        this check ensures that multiple calls to destroy_dyntracer on the same
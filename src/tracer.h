@@ -18,10 +18,35 @@ SEXP create_dyntracer(SEXP output_dirpath,
                       SEXP verbose,
                       SEXP truncate,
                       SEXP binary,
-                      SEXP compression_level);
+                      SEXP compression_level,
+                      SEXP primitive_typing_modes,
+                      SEXP default_primitive_typing_mode,
+                      SEXP profile_probes,
+                      SEXP memory_sampling_interval,
+                      SEXP record_events,
+                      SEXP wide_traces,
+                      SEXP track_dependencies,
+                      SEXP trace_memory_limit,
+                      SEXP shared_traces,
+                      SEXP shared_traces_size,
+                      SEXP trace_socket);
 
 SEXP destroy_dyntracer(SEXP dyntracer_sexp);
 
+SEXP tracer_memory_usage(SEXP dyntracer_sexp);
+
+SEXP tracer_stats(SEXP dyntracer_sexp);
+
+SEXP tracer_traces(SEXP dyntracer_sexp);
+
+SEXP begin_session_segment(SEXP dyntracer_sexp, SEXP analyzed_file_name);
+
+SEXP end_session(SEXP dyntracer_sexp);
+
+SEXP write_shared_traces(SEXP name, SEXP output_filepath, SEXP format);
+
+SEXP remove_shared_traces(SEXP name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,6 +3,7 @@
 
 // #include "constants.h"
 #include "definitions.h"
+#include "footprint.h"
 #include "stdlibs.h"
 
 #include <openssl/evp.h>
@@ -25,6 +26,10 @@ int mkdir_p(const char *path, mode_t mode);
 /* getting types */
 std::string get_type_of_sexp(SEXP thing);
 
+/* the parts of get_type_of_sexp for vectors, and lists and data frames */
+std::string vector_logic(std::string vec_type, SEXP vec_sexp);
+std::string list_logic(SEXP list_sxp);
+
 /* getting classes */
 std::vector<std::string> get_class_names(SEXP object);
 
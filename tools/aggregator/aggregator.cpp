@@ -0,0 +1,506 @@
+// Counts the traces that traced processes send over a Unix domain socket, see
+// TraceStream.h, and writes them to one traces file.
+//
+// Usage: aggregator [options] <socket-path> <output-file>
+//
+//   --format=<format>
+//       normalized (the default), wide or binary, see TraceRecord.h
+//   --interval=<seconds>
+//       how often the traces are written, 60 by default, 0 to only write
+//       them on exit
+//
+// The traces are written when they changed since they were last written,
+// and when the aggregator is stopped with SIGINT or SIGTERM. Each file is
+// written next to the output and renamed over it, so readers never see a
+// partial file. A socket file left at socket-path is replaced.
+//
+// Like in the merge tool, a trace is identified by its hash and the other
+// columns of the first row sent for it are kept. When a trace comes from
+// processes with different packages under analysis, its
+// package_being_analyzed is "*". A forked child only sends counts for the
+// traces its parent sent before forking, and these counts can arrive first,
+// so counts of unknown traces are kept until the trace arrives.
+
+#include "TraceRecord.h"
+#include "TraceStream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+
+const char USAGE[] =
+    "usage: aggregator [--format=normalized|wide|binary] [--interval=<s>]\n"
+    "                  <socket-path> <output-file>\n";
+
+const std::string ANY_PACKAGE = "*";
+
+/* bytes read from a connection at once */
+const std::size_t READ_SIZE = 1 << 16;
+
+volatile std::sig_atomic_t stop_requested = 0;
+
+void request_stop(int) {
+    stop_requested = 1;
+}
+
+TracesFormat parse_traces_format(const std::string& format) {
+    TracesFormat traces_format = traces_format_from_string(format);
+    if (traces_format == TracesFormat::COUNT) {
+        throw std::runtime_error("unknown traces format '" + format + "'");
+    }
+    return traces_format;
+}
+
+struct options_t {
+    std::string socket_path;
+    std::string output_filepath;
+    TracesFormat format = TracesFormat::Normalized;
+    int interval = 60;
+};
+
+options_t parse_options(int argc, char* argv[]) {
+    const std::string FORMAT_OPTION = "--format=";
+    const std::string INTERVAL_OPTION = "--interval=";
+
+    options_t options;
+    std::vector<std::string> arguments;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument.compare(0, FORMAT_OPTION.size(), FORMAT_OPTION) == 0) {
+            options.format =
+                parse_traces_format(argument.substr(FORMAT_OPTION.size()));
+        } else if (argument.compare(0, INTERVAL_OPTION.size(),
+                                    INTERVAL_OPTION) == 0) {
+            char* end = nullptr;
+            long interval =
+                std::strtol(argument.c_str() + INTERVAL_OPTION.size(), &end, 10);
+            if (*end != '\0' || interval < 0) {
+                throw std::runtime_error("invalid interval in '" + argument +
+                                         "'");
+            }
+            options.interval = interval;
+        } else if (argument.compare(0, 2, "--") == 0) {
+            throw std::runtime_error("unknown option '" + argument + "'");
+        } else {
+            arguments.push_back(argument);
+        }
+    }
+
+    if (arguments.size() != 2) {
+        throw std::runtime_error("expected 2 arguments, got " +
+                                 std::to_string(arguments.size()));
+    }
+
+    options.socket_path = arguments[0];
+    options.output_filepath = arguments[1];
+    return options;
+}
+
+// The traces of all the processes, by hash.
+class TraceAggregator {
+  public:
+    void add_trace(std::string_view package_under_analysis,
+                   std::size_t hash,
+                   std::uint64_t count,
+                   const std::vector<std::string_view>& columns) {
+        changed_ = true;
+        auto inserted = records_.insert({hash, TraceRecord()});
+        TraceRecord& record = inserted.first->second;
+        if (inserted.second || record.columns.empty()) {
+            /* new, or only counted so far */
+            record.package_under_analysis = std::string(package_under_analysis);
+            record.hash = hash;
+            record.count += count;
+            record.columns.assign(columns.begin(), columns.end());
+            return;
+        }
+        record.count += count;
+        if (record.package_under_analysis != package_under_analysis) {
+            record.package_under_analysis = ANY_PACKAGE;
+        }
+    }
+
+    void add_count(std::size_t hash, std::uint64_t count) {
+        changed_ = true;
+        auto inserted = records_.insert({hash, TraceRecord()});
+        if (inserted.second) {
+            inserted.first->second.hash = hash;
+            inserted.first->second.count = 0;
+        }
+        inserted.first->second.count += count;
+    }
+
+    bool has_changed() const {
+        return changed_;
+    }
+
+    std::size_t size() const {
+        return records_.size();
+    }
+
+    /* returns the number of traces written, those only counted are not */
+    std::size_t write(const std::string& filepath, TracesFormat format) {
+        std::vector<const TraceRecord*> records;
+        records.reserve(records_.size());
+        std::size_t position_count = 0;
+        for (const auto& element: records_) {
+            const TraceRecord& record = element.second;
+            if (!record.columns.empty()) {
+                records.push_back(&record);
+                position_count =
+                    std::max(position_count, record.get_position_count());
+            }
+        }
+        std::sort(records.begin(),
+                  records.end(),
+                  [](const TraceRecord* a, const TraceRecord* b) {
+                      return a->hash < b->hash;
+                  });
+
+        const std::string temporary_filepath = filepath + ".tmp";
+        TracesFileWriter writer(temporary_filepath, format, position_count);
+        for (const TraceRecord* record: records) {
+            writer.write(*record);
+        }
+        writer.close();
+
+        /* the traces file last, a reader that finds it finds the
+           dictionaries it refers to */
+        if (format == TracesFormat::Normalized) {
+            for (const std::string dictionary: {"types", "functions"}) {
+                rename_(traces_file::get_dictionary_filepath(
+                            temporary_filepath, dictionary),
+                        traces_file::get_dictionary_filepath(filepath,
+                                                             dictionary));
+            }
+        }
+        rename_(temporary_filepath, filepath);
+
+        changed_ = false;
+        return records.size();
+    }
+
+  private:
+    std::unordered_map<std::size_t, TraceRecord> records_;
+    bool changed_ = false;
+
+    static void rename_(const std::string& from, const std::string& to) {
+        if (std::rename(from.c_str(), to.c_str()) != 0) {
+            throw std::runtime_error("unable to rename " + from + " to " + to +
+                                     ": " + std::strerror(errno));
+        }
+    }
+};
+
+// Reads the values of a record from a buffer, failing if the buffer ends
+// before the record does.
+class RecordReader {
+  public:
+    RecordReader(const char* begin, const char* end)
+        : current_(begin), end_(end) {
+    }
+
+    const char* get_position() const {
+        return current_;
+    }
+
+    template <typename T>
+    bool read(T& value) {
+        if (static_cast<std::size_t>(end_ - current_) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, current_, sizeof(T));
+        current_ += sizeof(T);
+        return true;
+    }
+
+    bool read_string(std::string_view& string) {
+        std::uint32_t size;
+        if (!read(size) || static_cast<std::size_t>(end_ - current_) < size) {
+            return false;
+        }
+        string = std::string_view(current_, size);
+        current_ += size;
+        return true;
+    }
+
+  private:
+    const char* current_;
+    const char* end_;
+};
+
+// A process sending traces. Its bytes are buffered until they make up
+// complete records.
+class Connection {
+  public:
+    explicit Connection(int fd): fd_(fd), started_(false) {
+    }
+
+    ~Connection() {
+        close(fd_);
+    }
+
+    int get_fd() const {
+        return fd_;
+    }
+
+    /* returns false when the process is done */
+    bool receive(TraceAggregator& aggregator) {
+        std::size_t size = buffer_.size();
+        buffer_.resize(size + READ_SIZE);
+        ssize_t count = recv(fd_, &buffer_[size], READ_SIZE, 0);
+        buffer_.resize(size + std::max<ssize_t>(count, 0));
+        if (count < 0) {
+            return errno == EINTR || errno == EAGAIN;
+        }
+        consume_(aggregator);
+        if (count == 0 && !buffer_.empty()) {
+            throw std::runtime_error("stream ended in the middle of a record");
+        }
+        return count > 0;
+    }
+
+  private:
+    const int fd_;
+    std::string buffer_;
+    bool started_;
+    std::string package_under_analysis_;
+    std::vector<std::string_view> columns_;
+
+    /* processes the complete records, the rest is kept for later */
+    void consume_(TraceAggregator& aggregator) {
+        RecordReader reader(buffer_.data(), buffer_.data() + buffer_.size());
+        const char* consumed = reader.get_position();
+
+        if (!started_) {
+            if (!read_start_(reader)) {
+                return;
+            }
+            consumed = reader.get_position();
+        }
+
+        trace_stream::RecordKind kind;
+        while (reader.read(kind)) {
+            std::uint64_t hash;
+            std::uint64_t count;
+            if (!reader.read(hash) || !reader.read(count)) {
+                break;
+            }
+
+            if (kind == trace_stream::RecordKind::Count) {
+                aggregator.add_count(hash, count);
+            } else if (kind == trace_stream::RecordKind::Trace) {
+                if (!read_columns_(reader)) {
+                    break;
+                }
+                aggregator.add_trace(
+                    package_under_analysis_, hash, count, columns_);
+            } else {
+                throw std::runtime_error("unknown record kind " +
+                                         std::to_string(static_cast<int>(kind)));
+            }
+            consumed = reader.get_position();
+        }
+
+        buffer_.erase(0, consumed - buffer_.data());
+    }
+
+    bool read_start_(RecordReader& reader) {
+        char magic[sizeof(trace_stream::MAGIC)];
+        std::uint32_t version;
+        std::string_view package;
+        if (!reader.read(magic) || !reader.read(version) ||
+            !reader.read_string(package)) {
+            return false;
+        }
+        if (std::memcmp(magic, trace_stream::MAGIC, sizeof(magic)) != 0) {
+            throw std::runtime_error("not a trace stream");
+        }
+        if (version != trace_stream::VERSION) {
+            throw std::runtime_error("unsupported trace stream version " +
+                                     std::to_string(version));
+        }
+        package_under_analysis_ = std::string(package);
+        started_ = true;
+        return true;
+    }
+
+    bool read_columns_(RecordReader& reader) {
+        std::uint32_t column_count;
+        if (!reader.read(column_count)) {
+            return false;
+        }
+        columns_.resize(column_count);
+        for (std::string_view& column: columns_) {
+            if (!reader.read_string(column)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+int listen_on(const std::string& socket_path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("socket path too long: " + socket_path);
+    }
+    std::memcpy(address.sun_path, socket_path.data(), socket_path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        throw std::runtime_error(std::string("unable to create socket: ") +
+                                 std::strerror(errno));
+    }
+    unlink(socket_path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) ==
+            -1 ||
+        listen(fd, SOMAXCONN) == -1) {
+        std::string error = std::strerror(errno);
+        close(fd);
+        throw std::runtime_error("unable to listen on " + socket_path + ": " +
+                                 error);
+    }
+    return fd;
+}
+
+struct aggregation_statistics_t {
+    std::uint64_t connection_count = 0;
+    std::uint64_t error_count = 0;
+};
+
+void write_traces(const options_t& options,
+                  TraceAggregator& aggregator,
+                  const aggregation_statistics_t& statistics) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t trace_count =
+        aggregator.write(options.output_filepath, options.format);
+    double serialization_time = std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - start)
+                                    .count();
+    std::cerr << "connections: " << statistics.connection_count
+              << ", errors: " << statistics.error_count
+              << ", distinct traces: " << trace_count
+              << ", serialization time (s): " << serialization_time
+              << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    int listen_fd = -1;
+    options_t options;
+
+    try {
+        options = parse_options(argc, argv);
+
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        /* without SA_RESTART, so that poll returns */
+        action.sa_handler = request_stop;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        listen_fd = listen_on(options.socket_path);
+
+        TraceAggregator aggregator;
+        aggregation_statistics_t statistics;
+        std::vector<std::unique_ptr<Connection>> connections;
+        std::vector<pollfd> fds;
+
+        auto interval = std::chrono::seconds(options.interval);
+        auto next_write = std::chrono::steady_clock::now() + interval;
+
+        while (!stop_requested) {
+            fds.assign(1, {listen_fd, POLLIN, 0});
+            for (const auto& connection: connections) {
+                fds.push_back({connection->get_fd(), POLLIN, 0});
+            }
+
+            int timeout = -1;
+            if (options.interval != 0) {
+                timeout = std::max<long>(
+                    0,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        next_write - std::chrono::steady_clock::now())
+                        .count());
+            }
+
+            if (poll(fds.data(), fds.size(), timeout) == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("poll failed: ") +
+                                         std::strerror(errno));
+            }
+
+            /* the new connections are only polled on the next round */
+            std::size_t connection_count = connections.size();
+
+            if (fds[0].revents & POLLIN) {
+                int fd = accept(listen_fd, nullptr, nullptr);
+                if (fd != -1) {
+                    connections.push_back(std::make_unique<Connection>(fd));
+                    ++statistics.connection_count;
+                }
+            }
+
+            std::size_t kept = 0;
+            for (std::size_t index = 0; index < connection_count; ++index) {
+                bool open = true;
+                if (fds[index + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                    try {
+                        open = connections[index]->receive(aggregator);
+                    } catch (const std::runtime_error& e) {
+                        std::cerr << "aggregator: " << e.what() << std::endl;
+                        ++statistics.error_count;
+                        open = false;
+                    }
+                }
+                if (open) {
+                    std::swap(connections[kept++], connections[index]);
+                }
+            }
+            connections.erase(connections.begin() + kept,
+                              connections.begin() + connection_count);
+
+            if (options.interval != 0 &&
+                std::chrono::steady_clock::now() >= next_write) {
+                if (aggregator.has_changed()) {
+                    write_traces(options, aggregator, statistics);
+                }
+                next_write = std::chrono::steady_clock::now() + interval;
+            }
+        }
+
+        write_traces(options, aggregator, statistics);
+
+    } catch (const std::exception& e) {
+        std::cerr << "aggregator: " << e.what() << "\n" << USAGE;
+        if (listen_fd != -1) {
+            close(listen_fd);
+            unlink(options.socket_path.c_str());
+        }
+        return 1;
+    }
+
+    close(listen_fd);
+    unlink(options.socket_path.c_str());
+    return 0;
+}
@@ -0,0 +1,304 @@
+// Merges the traces files of several runs, in any format, into one traces
+// file with the counts of the traces summed.
+//
+// Usage: merge [options] <output-file> <traces-file>...
+//
+//   --threads=<n>
+//       number of threads, the number of cores by default
+//   --format=<format>
+//       normalized (the default), wide or binary, see TraceRecord.h
+//
+// The dictionaries of normalized traces files are looked up next to them,
+// and those of a normalized output are written next to it.
+//
+// Like in the tracer, a trace is identified by its hash and the other
+// columns of its first row, in the order of the input files, are kept. When a trace comes from runs of
+// different packages under analysis, its package_being_analyzed is "*".
+//
+// The input files are mapped in memory and parsed in place by the threads,
+// each taking the next file not yet taken. The traces are aggregated in a
+// table split in shards, each with its own lock, by trace hash. A thread
+// buffers the rows of each shard and locks the shard once per batch, and
+// only copies the rows of traces the shard has not seen yet or has only seen
+// later in the inputs. The merged traces are written sorted by hash, so the
+// output does not depend on the number of threads.
+
+#include "MappedFile.h"
+#include "TraceRecord.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+const char USAGE[] =
+    "usage: merge [--threads=<n>] [--format=normalized|wide|binary]\n"
+    "             <output-file> <traces-file>...\n";
+
+const std::string ANY_PACKAGE = "*";
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+TracesFormat parse_traces_format(const std::string& format) {
+    TracesFormat traces_format = traces_format_from_string(format);
+    if (traces_format == TracesFormat::COUNT) {
+        throw std::runtime_error("unknown traces format '" + format + "'");
+    }
+    return traces_format;
+}
+
+struct options_t {
+    std::string output_filepath;
+    std::vector<std::string> input_filepaths;
+    TracesFormat format = TracesFormat::Normalized;
+    unsigned int thread_count = get_default_thread_count();
+};
+
+options_t parse_options(int argc, char* argv[]) {
+    const std::string THREADS_OPTION = "--threads=";
+    const std::string FORMAT_OPTION = "--format=";
+
+    options_t options;
+    std::vector<std::string> arguments;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument.compare(0, FORMAT_OPTION.size(), FORMAT_OPTION) == 0) {
+            options.format =
+                parse_traces_format(argument.substr(FORMAT_OPTION.size()));
+        } else if (argument.compare(0, THREADS_OPTION.size(),
+                                    THREADS_OPTION) == 0) {
+            int thread_count =
+                std::atoi(argument.c_str() + THREADS_OPTION.size());
+            if (thread_count < 1) {
+                throw std::runtime_error("invalid thread count in '" +
+                                         argument + "'");
+            }
+            options.thread_count = thread_count;
+        } else if (argument.compare(0, 2, "--") == 0) {
+            throw std::runtime_error("unknown option '" + argument + "'");
+        } else {
+            arguments.push_back(argument);
+        }
+    }
+
+    if (arguments.size() < 2) {
+        throw std::runtime_error("expected at least 2 arguments, got " +
+                                 std::to_string(arguments.size()));
+    }
+
+    options.output_filepath = arguments.front();
+    options.input_filepaths.assign(arguments.begin() + 1, arguments.end());
+    return options;
+}
+
+/* bits of the order of a row given to its position in its file */
+const int ROW_ORDER_BITS = 40;
+
+/* a row with its order, its file index then its position in the file */
+struct ordered_view_t {
+    TraceRecordView view;
+    std::uint64_t order;
+};
+
+// Traces by hash, split in shards that are locked independently. The
+// columns kept for a trace are those of its row with the smallest order.
+class ShardedTraceTable {
+  public:
+    explicit ShardedTraceTable(std::size_t shard_count): shards_(shard_count) {
+    }
+
+    std::size_t get_shard_count() const {
+        return shards_.size();
+    }
+
+    std::size_t get_shard_index(std::size_t hash) const {
+        return hash % shards_.size();
+    }
+
+    /* all views have to be of traces of shard index */
+    void insert(std::size_t index, const std::vector<ordered_view_t>& views) {
+        shard_t& shard = shards_[index];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const ordered_view_t& ordered_view: views) {
+            const TraceRecordView& view = ordered_view.view;
+            auto iter = shard.records.find(view.hash);
+            if (iter == shard.records.end()) {
+                shard.records.emplace(
+                    view.hash, entry_t{view.to_record(), ordered_view.order});
+                continue;
+            }
+            entry_t& entry = iter->second;
+            TraceRecord& record = entry.record;
+            if (ordered_view.order < entry.order) {
+                record.columns.assign(view.columns.begin(),
+                                      view.columns.end());
+                entry.order = ordered_view.order;
+            }
+            record.count += view.count;
+            if (record.package_under_analysis != view.package_under_analysis) {
+                record.package_under_analysis = ANY_PACKAGE;
+            }
+        }
+    }
+
+    /* the records sorted by hash, the table is left empty */
+    std::vector<TraceRecord> release_records() {
+        std::vector<TraceRecord> records;
+        for (shard_t& shard: shards_) {
+            for (auto& element: shard.records) {
+                records.push_back(std::move(element.second.record));
+            }
+            shard.records.clear();
+        }
+        std::sort(records.begin(),
+                  records.end(),
+                  [](const TraceRecord& a, const TraceRecord& b) {
+                      return a.hash < b.hash;
+                  });
+        return records;
+    }
+
+  private:
+    struct entry_t {
+        TraceRecord record;
+        std::uint64_t order;
+    };
+
+    struct shard_t {
+        std::mutex mutex;
+        std::unordered_map<std::size_t, entry_t> records;
+    };
+
+    std::vector<shard_t> shards_;
+};
+
+/* rows buffered per shard before the shard is locked */
+const std::size_t BATCH_SIZE = 256;
+/* shards per thread, enough for threads to rarely wait on each other */
+const std::size_t SHARDS_PER_THREAD = 16;
+
+struct merge_statistics_t {
+    std::uint64_t row_count = 0;
+};
+
+void merge(const std::string& filepath,
+           std::size_t file_index,
+           ShardedTraceTable& table,
+           std::vector<std::vector<ordered_view_t>>& batches,
+           merge_statistics_t& statistics) {
+    MappedFile file(filepath);
+
+    /* the views of normalized rows point into the dictionaries */
+    std::unique_ptr<MappedFile> types;
+    std::unique_ptr<MappedFile> functions;
+    std::unique_ptr<TraceDictionary> dictionary;
+    if (traces_file::is_normalized(file.begin(), file.end())) {
+        types = std::make_unique<MappedFile>(
+            traces_file::get_dictionary_filepath(filepath, "types"));
+        functions = std::make_unique<MappedFile>(
+            traces_file::get_dictionary_filepath(filepath, "functions"));
+        dictionary = std::make_unique<TraceDictionary>(types->begin(),
+                                                       types->end(),
+                                                       functions->begin(),
+                                                       functions->end());
+    }
+
+    TraceRecordReader reader(file.begin(), file.end(), dictionary.get());
+    TraceRecordView view;
+    std::uint64_t order = static_cast<std::uint64_t>(file_index)
+                          << ROW_ORDER_BITS;
+
+    while (reader.next(view)) {
+        ++statistics.row_count;
+        std::size_t index = table.get_shard_index(view.hash);
+        std::vector<ordered_view_t>& batch = batches[index];
+        batch.push_back({view, ++order});
+        if (batch.size() == BATCH_SIZE) {
+            table.insert(index, batch);
+            batch.clear();
+        }
+    }
+
+    /* the views point into the files, which are unmapped on return */
+    for (std::size_t index = 0; index < batches.size(); ++index) {
+        if (!batches[index].empty()) {
+            table.insert(index, batches[index]);
+            batches[index].clear();
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        options_t options = parse_options(argc, argv);
+        const std::vector<std::string>& filepaths = options.input_filepaths;
+        unsigned int thread_count = std::min<std::size_t>(
+            options.thread_count, filepaths.size());
+
+        auto start = std::chrono::steady_clock::now();
+
+        ShardedTraceTable table(SHARDS_PER_THREAD * thread_count);
+        std::vector<merge_statistics_t> thread_statistics(thread_count);
+        std::atomic<std::size_t> next_filepath(0);
+
+        run_in_parallel(thread_count, [&](unsigned int index) {
+            std::vector<std::vector<ordered_view_t>> batches(
+                table.get_shard_count());
+            std::size_t filepath;
+            while ((filepath = next_filepath++) < filepaths.size()) {
+                try {
+                    merge(filepaths[filepath],
+                          filepath,
+                          table,
+                          batches,
+                          thread_statistics[index]);
+                } catch (const std::runtime_error& e) {
+                    throw std::runtime_error(filepaths[filepath] + ": " +
+                                             e.what());
+                }
+            }
+        });
+
+        double merge_time = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+
+        std::vector<TraceRecord> records = table.release_records();
+        TraceRecord::write_files(
+            options.output_filepath, records, options.format);
+
+        double serialization_time = seconds_since(start);
+
+        merge_statistics_t statistics;
+        for (const merge_statistics_t& thread: thread_statistics) {
+            statistics.row_count += thread.row_count;
+        }
+
+        std::cerr << "traces files: " << filepaths.size() << "\n"
+                  << "threads: " << thread_count << "\n"
+                  << "rows: " << statistics.row_count << "\n"
+                  << "distinct traces: " << records.size() << "\n"
+                  << "merge time (s): " << merge_time << "\n"
+                  << "serialization time (s): " << serialization_time
+                  << std::endl;
+
+    } catch (const std::exception& e) {
+        std::cerr << "merge: " << e.what() << "\n" << USAGE;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Writes event logs whose calls have traces with the same hash but
+// different rows, for checking that the traces written by replay and merge
+// do not depend on the number of threads (see make check-tools).
+//
+// Usage: collisions <output-dirpath> <log-count>
+//
+// The hash of a trace does not cover whether the function has dots, so the
+// calls of a function with the same types, with and without dots, are one
+// trace whose row is that of the call seen first. The functions of odd logs
+// have dots and those of even logs do not, and each log leaves out a third
+// of the functions, so the first log a trace is in is not always the first
+// log. The logs are written as events_<index>.bin, with the index
+// zero-padded so the logs sort in the order they were written.
+
+#include "EventLog.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sys/stat.h>
+
+namespace {
+
+const char USAGE[] = "usage: collisions <output-dirpath> <log-count>\n";
+
+const int FUNCTION_COUNT = 4096;
+const int CALL_COUNT = 65536;
+const char* const TYPES[] = {"integer", "double", "character", "logical"};
+
+void write_log(const std::string& filepath, int log_index) {
+    EventLogWriter writer(
+        filepath, "collisions", [](sexptype_t) { return std::string(); });
+
+    for (int call = 0; call < CALL_COUNT; ++call) {
+        int function = (call * 7 + log_index) % FUNCTION_COUNT;
+        if ((function + log_index) % 3 == 0) {
+            continue;
+        }
+        std::string name = "f" + std::to_string(function);
+        CallTrace trace("collisions", name, "collisions::" + name, 0, call);
+        trace.set_has_dots(log_index % 2 == 1);
+        trace.add_to_call_trace(-1, Type(std::string(TYPES[function % 4])));
+        for (int position = 0; position < function % 3; ++position) {
+            trace.add_to_call_trace(
+                position, Type(std::string(TYPES[(call + position) % 2])));
+        }
+        writer.write_call(trace, false);
+    }
+    writer.close();
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 || std::atoi(argv[2]) < 1) {
+        std::cerr << USAGE;
+        return 1;
+    }
+
+    std::string output_dirpath = argv[1];
+    int log_count = std::atoi(argv[2]);
+    mkdir(output_dirpath.c_str(), S_IRWXU);
+
+    for (int log_index = 0; log_index < log_count; ++log_index) {
+        char filename[32];
+        std::snprintf(filename, sizeof(filename), "events_%04d.bin", log_index);
+        write_log(output_dirpath + "/" + filename, log_index);
+    }
+    return 0;
+}
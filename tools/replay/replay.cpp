@@ -0,0 +1,316 @@
+// Replays event logs recorded with record_events = TRUE through the trace
+// analysis and writes the traces file the tracer would have written, with
+// the traces of all logs aggregated.
+//
+// Usage: replay [options] <event-log>... <output-dirpath> <analyzed-file-name>
+//
+//   --threads=<n>
+//       number of threads, the number of cores by default
+//   --default-primitive-typing-mode=<mode>
+//       typing mode of builtins and specials, full by default
+//   --primitive-typing-mode=<primitive>=<mode>
+//       typing mode of one builtin or special, can be repeated
+//   --format=<format>
+//       normalized (the default), wide or binary, see TraceRecord.h
+//
+// The modes are those of create_dyntracer. Replay can only reduce the
+// precision the calls were recorded with: primitives recorded with a less
+// precise mode are replayed as recorded and primitives that were not traced
+// are not in the log at all. All logs must be of the same package under
+// analysis.
+//
+// The logs are divided between the threads, each of which aggregates the
+// traces of its logs in its own trace table. The tables are then merged in
+// parallel, each thread merging the traces whose hash goes to it. Traces
+// with the same hash are one trace, kept with the row of the call seen first
+// in the order of the logs, so the output does not depend on the number of
+// threads.
+//
+// The time spent reading and analyzing the log and writing the traces is
+// printed on stderr, which makes the log a reproducible input for profiling
+// the analysis.
+
+#include "EventLog.h"
+#include "TraceTable.h"
+#include "TypingMode.h"
+#include "parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+
+namespace {
+
+const char USAGE[] =
+    "usage: replay [--threads=<n>]\n"
+    "              [--default-primitive-typing-mode=<mode>]\n"
+    "              [--primitive-typing-mode=<primitive>=<mode>]...\n"
+    "              [--format=normalized|wide|binary]\n"
+    "              <event-log>... <output-dirpath> <analyzed-file-name>\n";
+
+TypingMode parse_typing_mode(const std::string& mode) {
+    TypingMode typing_mode = typing_mode_from_string(mode);
+    if (typing_mode == TypingMode::COUNT) {
+        throw std::runtime_error("unknown typing mode '" + mode + "'");
+    }
+    return typing_mode;
+}
+
+TracesFormat parse_traces_format(const std::string& format) {
+    TracesFormat traces_format = traces_format_from_string(format);
+    if (traces_format == TracesFormat::COUNT) {
+        throw std::runtime_error("unknown traces format '" + format + "'");
+    }
+    return traces_format;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+struct options_t {
+    std::vector<std::string> event_log_filepaths;
+    std::string output_dirpath;
+    std::string analyzed_file_name;
+    TypingMode default_primitive_typing_mode = TypingMode::Full;
+    std::unordered_map<std::string, TypingMode> primitive_typing_modes;
+    unsigned int thread_count = get_default_thread_count();
+    TracesFormat format = TracesFormat::Normalized;
+};
+
+options_t parse_options(int argc, char* argv[]) {
+    const std::string DEFAULT_MODE_OPTION = "--default-primitive-typing-mode=";
+    const std::string MODE_OPTION = "--primitive-typing-mode=";
+    const std::string THREADS_OPTION = "--threads=";
+    const std::string FORMAT_OPTION = "--format=";
+
+    options_t options;
+    std::vector<std::string> arguments;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument.compare(0, DEFAULT_MODE_OPTION.size(),
+                             DEFAULT_MODE_OPTION) == 0) {
+            options.default_primitive_typing_mode =
+                parse_typing_mode(argument.substr(DEFAULT_MODE_OPTION.size()));
+        } else if (argument.compare(0, MODE_OPTION.size(), MODE_OPTION) == 0) {
+            std::string binding = argument.substr(MODE_OPTION.size());
+            std::size_t separator = binding.rfind('=');
+            if (separator == std::string::npos || separator == 0) {
+                throw std::runtime_error("expected <primitive>=<mode> in '" +
+                                         argument + "'");
+            }
+            options.primitive_typing_modes.insert_or_assign(
+                binding.substr(0, separator),
+                parse_typing_mode(binding.substr(separator + 1)));
+        } else if (argument.compare(0, THREADS_OPTION.size(),
+                                    THREADS_OPTION) == 0) {
+            int thread_count =
+                std::atoi(argument.c_str() + THREADS_OPTION.size());
+            if (thread_count < 1) {
+                throw std::runtime_error("invalid thread count in '" +
+                                         argument + "'");
+            }
+            options.thread_count = thread_count;
+        } else if (argument.compare(0, FORMAT_OPTION.size(), FORMAT_OPTION) ==
+                   0) {
+            options.format =
+                parse_traces_format(argument.substr(FORMAT_OPTION.size()));
+        } else if (argument.compare(0, 2, "--") == 0) {
+            throw std::runtime_error("unknown option '" + argument + "'");
+        } else {
+            arguments.push_back(argument);
+        }
+    }
+
+    if (arguments.size() < 3) {
+        throw std::runtime_error("expected at least 3 arguments, got " +
+                                 std::to_string(arguments.size()));
+    }
+
+    options.analyzed_file_name = arguments.back();
+    arguments.pop_back();
+    options.output_dirpath = arguments.back();
+    arguments.pop_back();
+    options.event_log_filepaths = arguments;
+    return options;
+}
+
+TypingMode get_typing_mode(const options_t& options,
+                           const event_log::call_record_t& call) {
+    if (!call.primitive) {
+        return TypingMode::Full;
+    }
+    /* like the tracer, primitives are looked up by function id */
+    auto iter = options.primitive_typing_modes.find(call.function_id);
+    if (iter != options.primitive_typing_modes.end()) {
+        return iter->second;
+    }
+    return options.default_primitive_typing_mode;
+}
+
+/* the same types deal_with_builtin_and_special makes in each mode */
+Type reduce_type(const EventLogReader& reader,
+                 type_id_t type_id,
+                 TypingMode typing_mode) {
+    switch (typing_mode) {
+    case TypingMode::Arity:
+        return Type(std::string("any"));
+    case TypingMode::SexpType:
+        return Type(reader.get_sexptype_name(type_id));
+    default:
+        return reader.get_type(type_id);
+    }
+}
+
+struct replay_statistics_t {
+    std::uint64_t call_count = 0;
+    std::uint64_t dropped_call_count = 0;
+};
+
+/* bits of the order of a trace given to its call in its log */
+const int CALL_ORDER_BITS = 40;
+
+// Inserts the traces of the calls of the log, ordered by log_index then by
+// call, so the merged tables keep the trace seen first in the logs whichever
+// thread replays which log.
+void replay(const options_t& options,
+            std::size_t log_index,
+            const std::string& event_log_filepath,
+            TraceTable& trace_table,
+            std::string& package_under_analysis,
+            replay_statistics_t& statistics) {
+    EventLogReader reader(event_log_filepath);
+    package_under_analysis = reader.get_package_under_analysis();
+    event_log::call_record_t call;
+    std::uint64_t order = static_cast<std::uint64_t>(log_index)
+                          << CALL_ORDER_BITS;
+
+    while (reader.next(call)) {
+        ++statistics.call_count;
+        ++order;
+
+        TypingMode typing_mode = get_typing_mode(options, call);
+        if (typing_mode == TypingMode::Off) {
+            ++statistics.dropped_call_count;
+            continue;
+        }
+
+        CallTrace trace(call.package_name,
+                        call.function_name,
+                        call.function_id,
+                        call.dispatch,
+                        call.context_id);
+        trace.set_has_dots(call.has_dots);
+        for (const auto& argument: call.arguments) {
+            trace.add_to_call_trace(
+                argument.first,
+                reduce_type(reader, argument.second, typing_mode));
+        }
+
+        trace_table.insert(trace, 1, order);
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        options_t options = parse_options(argc, argv);
+        const std::vector<std::string>& filepaths = options.event_log_filepaths;
+        unsigned int thread_count = std::min<std::size_t>(
+            options.thread_count, filepaths.size());
+
+        auto start = std::chrono::steady_clock::now();
+
+        /* each thread takes the next log not yet taken */
+        std::vector<TraceTable> thread_tables(thread_count);
+        std::vector<replay_statistics_t> thread_statistics(thread_count);
+        std::vector<std::string> packages(filepaths.size());
+        std::atomic<std::size_t> next_filepath(0);
+
+        run_in_parallel(thread_count, [&](unsigned int index) {
+            std::size_t filepath;
+            while ((filepath = next_filepath++) < filepaths.size()) {
+                replay(options,
+                       filepath,
+                       filepaths[filepath],
+                       thread_tables[index],
+                       packages[filepath],
+                       thread_statistics[index]);
+            }
+        });
+
+        for (const std::string& package: packages) {
+            if (package != packages.front()) {
+                throw std::runtime_error("logs of different packages, '" +
+                                         packages.front() + "' and '" +
+                                         package + "'");
+            }
+        }
+
+        double analysis_time = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+
+        /* a trace is merged by the thread its hash goes to, so the merged
+           tables have no traces in common, and each keeps the trace with
+           the smallest order */
+        std::vector<TraceTable> merged_tables(thread_count);
+        if (thread_count == 1) {
+            merged_tables[0] = std::move(thread_tables[0]);
+        } else {
+            run_in_parallel(thread_count, [&](unsigned int index) {
+                auto keep = [thread_count, index](const CallTrace& trace) {
+                    return trace.compute_hash() % thread_count == index;
+                };
+                for (const TraceTable& table: thread_tables) {
+                    merged_tables[index].merge(table, keep);
+                }
+            });
+        }
+
+        double merge_time = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+
+        std::vector<const TraceTable*> tables;
+        replay_statistics_t statistics;
+        std::size_t trace_count = 0;
+        for (unsigned int index = 0; index < thread_count; ++index) {
+            tables.push_back(&merged_tables[index]);
+            trace_count += merged_tables[index].size();
+            statistics.call_count += thread_statistics[index].call_count;
+            statistics.dropped_call_count +=
+                thread_statistics[index].dropped_call_count;
+        }
+
+        mkdir(options.output_dirpath.c_str(), S_IRWXU);
+        TraceTable::serialize(
+            tables,
+            options.output_dirpath + "/traces_" + options.analyzed_file_name +
+                (options.format == TracesFormat::Binary ? ".bin" : ".txt"),
+            packages.front(),
+            options.format);
+
+        double serialization_time = seconds_since(start);
+
+        std::cerr << "event logs: " << filepaths.size() << "\n"
+                  << "threads: " << thread_count << "\n"
+                  << "calls: " << statistics.call_count << "\n"
+                  << "dropped calls: " << statistics.dropped_call_count << "\n"
+                  << "distinct traces: " << trace_count << "\n"
+                  << "analysis time (s): " << analysis_time << "\n"
+                  << "merge time (s): " << merge_time << "\n"
+                  << "serialization time (s): " << serialization_time
+                  << std::endl;
+
+    } catch (const std::exception& e) {
+        std::cerr << "replay: " << e.what() << "\n" << USAGE;
+        return 1;
+    }
+
+    return 0;
+}